@@ -163,6 +163,16 @@ extern "C" void EpochLLVMCodeCreateBranch(void* context, void* target, bool seti
 	reinterpret_cast<CodeGen::Context*>(context)->CodeCreateBranch(reinterpret_cast<llvm::BasicBlock*>(target), setinsertpoint);
 }
 
+extern "C" void EpochLLVMCodeCreateBufferRead(void* context, void* resulttype, unsigned bytes)
+{
+	reinterpret_cast<CodeGen::Context*>(context)->CodeCreateBufferRead(reinterpret_cast<llvm::Type*>(resulttype), bytes);
+}
+
+extern "C" void EpochLLVMCodeCreateBufferWrite(void* context, unsigned bytes)
+{
+	reinterpret_cast<CodeGen::Context*>(context)->CodeCreateBufferWrite(bytes);
+}
+
 extern "C" void* EpochLLVMCodeCreateCall(void* context, void* target)
 {
 	return reinterpret_cast<CodeGen::Context*>(context)->CodeCreateCall(reinterpret_cast<llvm::Function*>(target));
@@ -231,6 +241,11 @@ extern "C" void EpochLLVMCodeCreateRetVoid(void* context)
 	reinterpret_cast<CodeGen::Context*>(context)->CodeCreateRetVoid();
 }
 
+extern "C" void EpochLLVMCodeCreateStringConcat(void* context, unsigned count)
+{
+	reinterpret_cast<CodeGen::Context*>(context)->CodeCreateStringConcat(count);
+}
+
 extern "C" void EpochLLVMCodeCreateWrite(void* context, void* allocatarget)
 {
 	reinterpret_cast<CodeGen::Context*>(context)->CodeCreateWrite(reinterpret_cast<llvm::AllocaInst*>(allocatarget));
@@ -427,6 +442,16 @@ extern "C" void EpochLLVMStructureQueueMemberType(void* context, void* membertyp
 	reinterpret_cast<CodeGen::Context*>(context)->StructureTypeQueueMember(reinterpret_cast<llvm::Type*>(membertype));
 }
 
+extern "C" void EpochLLVMStructureQueueMemberTypeID(void* context, unsigned membertypeid)
+{
+	reinterpret_cast<CodeGen::Context*>(context)->StructureTypeQueueMemberTypeID(membertypeid);
+}
+
+extern "C" void EpochLLVMStructureTypeRegisterGC(void* context, void* structtype, unsigned structtypeid)
+{
+	reinterpret_cast<CodeGen::Context*>(context)->StructureTypeRegisterGC(reinterpret_cast<llvm::Type*>(structtype), structtypeid);
+}
+
 
 
 extern "C" void* EpochLLVMSumTypeCreate(void* context, const wchar_t* name, unsigned width)
@@ -436,6 +461,11 @@ extern "C" void* EpochLLVMSumTypeCreate(void* context, const wchar_t* name, unsi
 	return reinterpret_cast<CodeGen::Context*>(context)->SumTypeCreate(narrowname.c_str(), width);
 }
 
+extern "C" void EpochLLVMSumTypeRegisterGC(void* context, void* sumtype, unsigned sumtypeid)
+{
+	reinterpret_cast<CodeGen::Context*>(context)->SumTypeRegisterGC(reinterpret_cast<llvm::Type*>(sumtype), sumtypeid);
+}
+
 
 extern "C" void EpochLLVMCodeMergeSumType(void* context)
 {
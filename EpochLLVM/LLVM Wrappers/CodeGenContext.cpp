@@ -411,7 +411,6 @@ void Context::PrepareBinaryObject()
 
 	GlobalVariable* exitprocessfunctionvar = FunctionCreateThunk("ExitProcess", exitprocesstype);
 	GlobalVariable* gcinitfunctionvar = FunctionCreateThunk("ERT_gc_init", exitprocesstype);
-	GlobalVariable* gccollectstrsfunctionvar = FunctionCreateThunk("ERT_gc_collect_strings", voidtype);
 
 
 	GlobalVariable* gcdataoffset = new GlobalVariable(*LLVMModule, TypeGetInteger(), true, GlobalValue::ExternalWeakLinkage, nullptr, "gcdataoffset", nullptr, GlobalValue::NotThreadLocal, 0, true);
@@ -425,8 +424,8 @@ void Context::PrepareBinaryObject()
 	LLVMBuilder.CreateCall(EntryPointFunction);
 	TagDebugLine(++hack, 0);
 
-	LLVMBuilder.CreateCall(LLVMBuilder.CreateLoad(gccollectstrsfunctionvar));
-	TagDebugLine(++hack, 0);
+	// No final string collection here: ExitProcess is about to hand
+	// every page back to the OS anyway
 
 	LLVMBuilder.CreateCall(LLVMBuilder.CreateLoad(exitprocessfunctionvar), ConstantInt::get(TypeGetInteger(), 0));
 	TagDebugLine(++hack, 0);
@@ -651,16 +650,171 @@ llvm::AllocaInst* Context::CodeCreateAlloca(llvm::Type* vartype, const char* var
 	}
 
 	if(vartype == Type::getInt8PtrTy(getGlobalContext()))
+		CodeCreateGCRoot(allocainst, 0x02000000);
+	else if(uint32_t epochtypeid = GCCompilation::GetTypeID(vartype))
+	{
+		// Roots must be pointer-typed, so structures and sum types get
+		// a slot pointing at them. Zero the value first so the collector
+		// never follows a stale member before the constructor has run.
+		LLVMBuilder.CreateStore(Constant::getNullValue(vartype), allocainst);
+
+		AllocaInst* rootslot = LLVMBuilder.CreateAlloca(Type::getInt8PtrTy(getGlobalContext()));
+		CodeCreateGCRoot(rootslot, epochtypeid);
+		LLVMBuilder.CreateStore(LLVMBuilder.CreatePointerCast(allocainst, Type::getInt8PtrTy(getGlobalContext())), rootslot);
+	}
+	else if(vartype->isPointerTy())
 	{
-		Value* signature = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0x02000000);
-		Value* constant = LLVMBuilder.CreateIntToPtr(signature, Type::getInt8PtrTy(getGlobalContext()));
-		Value* castptr = LLVMBuilder.CreatePointerCast(allocainst, Type::getInt8PtrTy(getGlobalContext())->getPointerTo());
-		LLVMBuilder.CreateCall(GCRootFunction, { castptr, constant });
+		// A reference already is such a slot
+		if(uint32_t epochtypeid = GCCompilation::GetTypeID(vartype->getPointerElementType()))
+			CodeCreateGCRoot(allocainst, epochtypeid);
 	}
 
 	return allocainst;
 }
 
+
+//
+// Register a stack slot with the collector. String roots hold the
+// string itself; roots of any other type hold the address of a value
+// of that type, which is traced using the type layout table.
+//
+void Context::CodeCreateGCRoot(llvm::AllocaInst* root, uint32_t epochtypeid)
+{
+	Value* signature = ConstantInt::get(Type::getInt32Ty(getGlobalContext()), epochtypeid);
+	Value* constant = LLVMBuilder.CreateIntToPtr(signature, Type::getInt8PtrTy(getGlobalContext()));
+	Value* castptr = LLVMBuilder.CreatePointerCast(root, Type::getInt8PtrTy(getGlobalContext())->getPointerTo());
+	LLVMBuilder.CreateCall(GCRootFunction, { castptr, constant });
+}
+
+//
+// Make a rooted slot for a value that lives only in the middle of
+// an expression. The slot is placed in the entry block, alongside
+// the function's named locals, so it is set up once per call no
+// matter where the temporary is created.
+//
+llvm::AllocaInst* Context::CodeCreateRootedTemporary(uint32_t epochtypeid)
+{
+	BasicBlock* current = LLVMBuilder.GetInsertBlock();
+	BasicBlock& entry = current->getParent()->getEntryBlock();
+
+	IRBuilderBase::InsertPointGuard guard(LLVMBuilder);
+	LLVMBuilder.SetInsertPoint(&entry, entry.getFirstInsertionPt());
+
+	AllocaInst* slot = LLVMBuilder.CreateAlloca(Type::getInt8PtrTy(getGlobalContext()));
+	CodeCreateGCRoot(slot, epochtypeid);
+	return slot;
+}
+
+//
+// Structures are stack allocated, but one wrapped into a sum type can
+// be reached through the sum type long after the frame that owns it
+// has returned (a list node being the obvious example). The payload
+// of such a sum type is therefore a copy of the structure made in the
+// GC heap, rather than the address of the local.
+//
+llvm::Value* Context::BoxSumTypePayload(llvm::Value* payload, std::vector<llvm::Value*>* liveargs)
+{
+	AllocaInst* local = dyn_cast<AllocaInst>(payload);
+	if(!local || !GCCompilation::IsStructureType(local->getAllocatedType()))
+		return payload;
+
+	uint32_t epochtypeid = GCCompilation::GetTypeID(local->getAllocatedType());
+
+	Type* int32type = Type::getInt32Ty(getGlobalContext());
+	FunctionType* alloctype = FunctionType::get(Type::getInt8PtrTy(getGlobalContext()), { int32type }, false);
+	GlobalVariable* allocthunk = FunctionCreateThunk("ERT_gc_alloc_structure", alloctype);
+
+	// The allocation is a safepoint, and arguments already evaluated
+	// for an enclosing call are live across it
+	SpilledTemporaryList spilled;
+	SpillLiveTemporaries(PendingValues, spilled);
+	if(liveargs)
+		SpillLiveTemporaries(*liveargs, spilled);
+
+	Value* box = LLVMBuilder.CreateCall(LLVMBuilder.CreateLoad(allocthunk), { ConstantInt::get(int32type, epochtypeid) });
+	ReloadLiveTemporaries(spilled);
+
+	// Keep the copy alive until it has been stored somewhere rooted
+	LLVMBuilder.CreateStore(box, CodeCreateRootedTemporary(epochtypeid));
+
+	Value* typedbox = LLVMBuilder.CreatePointerCast(box, local->getType());
+	LLVMBuilder.CreateStore(LLVMBuilder.CreateLoad(local), typedbox);
+	return typedbox;
+}
+
+
+//
+// Strings only appear in stack maps while they sit in rooted slots,
+// so an intermediate value that is still waiting to be used when a
+// call is made could be freed, or moved out of the nursery without
+// the copy we hold being updated. Any string on the pending value
+// stack at a call site is live across that call; it is stored into
+// a rooted slot beforehand and reloaded afterwards.
+//
+// A spilled value is only needed for the duration of one call, so
+// each function keeps a small set of slots that every call site in
+// it shares.
+//
+void Context::SpillLiveTemporaries(std::vector<llvm::Value*>& values, SpilledTemporaryList& spilled)
+{
+	Function* function = LLVMBuilder.GetInsertBlock()->getParent();
+	if(function != TemporarySlotOwner)
+	{
+		TemporarySlotOwner = function;
+		TemporarySlots.clear();
+	}
+
+	for(Value*& value : values)
+	{
+		// Constants (static strings, null) are never collected or moved
+		if(!value || value->getType() != Type::getInt8PtrTy(getGlobalContext()) || isa<Constant>(value))
+			continue;
+
+		if(spilled.size() == TemporarySlots.size())
+			TemporarySlots.push_back(CodeCreateRootedTemporary(0x02000000));
+
+		AllocaInst* slot = TemporarySlots[spilled.size()];
+		LLVMBuilder.CreateStore(value, slot);
+		spilled.push_back(std::make_pair(&value, slot));
+	}
+}
+
+void Context::ReloadLiveTemporaries(const SpilledTemporaryList& spilled)
+{
+	for(auto& entry : spilled)
+		*entry.first = LLVMBuilder.CreateLoad(entry.second);
+}
+
+//
+// String parameters arrive as plain values, which the collector cannot
+// see or update. They are copied into rooted slots on entry, and read
+// from there; other parameters are used directly.
+//
+llvm::Value* Context::GetParamStorage(unsigned index)
+{
+	auto iter = LLVMBuilder.GetInsertBlock()->getParent()->arg_begin();
+	std::advance(iter, index);
+
+	Argument* arg = static_cast<Argument*>(iter);
+	if(arg->getType() != Type::getInt8PtrTy(getGlobalContext()))
+		return arg;
+
+	AllocaInst*& slot = ParamRootSlots[arg];
+	if(!slot)
+	{
+		BasicBlock& entry = arg->getParent()->getEntryBlock();
+
+		IRBuilderBase::InsertPointGuard guard(LLVMBuilder);
+		LLVMBuilder.SetInsertPoint(&entry, entry.getFirstInsertionPt());
+
+		slot = LLVMBuilder.CreateAlloca(arg->getType());
+		CodeCreateGCRoot(slot, 0x02000000);
+		LLVMBuilder.CreateStore(arg, slot);
+	}
+
+	return slot;
+}
+
 llvm::BasicBlock* Context::CodeCreateBasicBlock(llvm::Function* parent, bool setinsertpoint)
 {
 	BasicBlock* bb = BasicBlock::Create(getGlobalContext(), "", parent);
@@ -676,6 +830,94 @@ void Context::CodeCreateBranch(BasicBlock* target, bool setinsertpoint)
 		LLVMBuilder.SetInsertPoint(target);
 }
 
+//
+// Typed access to the bytes of a buffer, emitted in place instead of
+// as a call into the runtime. The stack holds the buffer (itself, or
+// a reference to it) and a byte offset, then for a write the value.
+// Reads of fewer bytes than the result type are zero extended, and
+// writes keep the low bytes of the value. Offsets need no alignment.
+//
+void Context::CodeCreateBufferRead(llvm::Type* resulttype, unsigned bytes)
+{
+	Value* offset = PendingValues.back();
+	PendingValues.pop_back();
+	Value* buffer = PendingValues.back();
+	PendingValues.pop_back();
+
+	Type* storedtype = resulttype;
+	if(resulttype->isIntegerTy() && resulttype->getIntegerBitWidth() > bytes * 8)
+		storedtype = Type::getIntNTy(getGlobalContext(), bytes * 8);
+
+	Value* address = GetCheckedBufferAddress(buffer, offset, storedtype, bytes);
+	LoadInst* load = LLVMBuilder.CreateLoad(address);
+	load->setAlignment(1);
+
+	Value* rv = load;
+	if(storedtype != resulttype)
+		rv = LLVMBuilder.CreateZExt(load, resulttype);
+
+	PendingValues.push_back(rv);
+}
+
+void Context::CodeCreateBufferWrite(unsigned bytes)
+{
+	Value* value = PendingValues.back();
+	PendingValues.pop_back();
+	Value* offset = PendingValues.back();
+	PendingValues.pop_back();
+	Value* buffer = PendingValues.back();
+	PendingValues.pop_back();
+
+	if(value->getType()->isIntegerTy() && value->getType()->getIntegerBitWidth() > bytes * 8)
+		value = LLVMBuilder.CreateTrunc(value, Type::getIntNTy(getGlobalContext(), bytes * 8));
+
+	Value* address = GetCheckedBufferAddress(buffer, offset, value->getType(), bytes);
+	StoreInst* store = LLVMBuilder.CreateStore(value, address);
+	store->setAlignment(1);
+}
+
+//
+// Address of the given number of bytes at an offset into a buffer,
+// after checking that they lie inside it. The runtime keeps the size
+// of a buffer in the length field of its block header, 8 bytes in
+// front of the first byte; a null buffer has no size at all. A failed
+// check calls ERT_buffer_bounds_failure, which does not return, so
+// the check costs a compare and a branch that is never taken.
+//
+llvm::Value* Context::GetCheckedBufferAddress(llvm::Value* buffer, llvm::Value* offset, llvm::Type* accesstype, unsigned bytes)
+{
+	Type* int32type = Type::getInt32Ty(getGlobalContext());
+	Type* int64type = Type::getInt64Ty(getGlobalContext());
+
+	if(buffer->getType() != TypeGetBuffer())
+		buffer = LLVMBuilder.CreateLoad(buffer);
+
+	Function* parent = LLVMBuilder.GetInsertBlock()->getParent();
+	BasicBlock* sizeblock = BasicBlock::Create(getGlobalContext(), "buffersize", parent);
+	BasicBlock* failblock = BasicBlock::Create(getGlobalContext(), "bufferbounds", parent);
+	BasicBlock* okblock = BasicBlock::Create(getGlobalContext(), "bufferaccess", parent);
+
+	Value* isnull = LLVMBuilder.CreateICmpEQ(buffer, ConstantPointerNull::get(cast<PointerType>(buffer->getType())));
+	LLVMBuilder.CreateCondBr(isnull, failblock, sizeblock);
+
+	LLVMBuilder.SetInsertPoint(sizeblock);
+	Value* sizeaddress = LLVMBuilder.CreateGEP(buffer, ConstantInt::getSigned(int32type, -8));
+	Value* size = LLVMBuilder.CreateLoad(LLVMBuilder.CreatePointerCast(sizeaddress, int32type->getPointerTo()));
+	Value* end = LLVMBuilder.CreateAdd(LLVMBuilder.CreateZExt(offset, int64type), ConstantInt::get(int64type, bytes));
+	Value* inside = LLVMBuilder.CreateICmpULE(end, LLVMBuilder.CreateZExt(size, int64type));
+	LLVMBuilder.CreateCondBr(inside, okblock, failblock);
+
+	LLVMBuilder.SetInsertPoint(failblock);
+	FunctionType* failtype = FunctionType::get(TypeGetVoid(), { TypeGetBuffer(), int32type, int32type }, false);
+	GlobalVariable* failthunk = FunctionCreateThunk("ERT_buffer_bounds_failure", failtype);
+	LLVMBuilder.CreateCall(LLVMBuilder.CreateLoad(failthunk), { buffer, offset, ConstantInt::get(int32type, bytes) });
+	LLVMBuilder.CreateUnreachable();
+
+	LLVMBuilder.SetInsertPoint(okblock);
+	Value* address = LLVMBuilder.CreateGEP(buffer, offset);
+	return LLVMBuilder.CreatePointerCast(address, accesstype->getPointerTo());
+}
+
 llvm::CallInst* Context::CodeCreateCall(llvm::Function* target)
 {
 	llvm::FunctionType* fty = target->getFunctionType();
@@ -735,7 +977,7 @@ llvm::CallInst* Context::CodeCreateCall(llvm::Function* target)
 					}
 				}
 	
-				payload = LLVMBuilder.CreatePtrToInt(rawpayload, paramtype->getStructElementType(1));
+				payload = LLVMBuilder.CreatePtrToInt(BoxSumTypePayload(rawpayload, &relevantargs), paramtype->getStructElementType(1));
 
 				PendingValues.pop_back();
 			}
@@ -761,7 +1003,11 @@ llvm::CallInst* Context::CodeCreateCall(llvm::Function* target)
 		}
 	}
 
+	SpilledTemporaryList spilled;
+	SpillLiveTemporaries(PendingValues, spilled);
+
 	llvm::CallInst* inst = LLVMBuilder.CreateCall(target, relevantargs);
+	ReloadLiveTemporaries(spilled);
 
 	if(inst->getType() != Type::getVoidTy(getGlobalContext()))
 		PendingValues.push_back(inst);
@@ -782,7 +1028,11 @@ void Context::CodeCreateCallIndirect(llvm::AllocaInst* targetAlloca)
 	}
 	std::reverse(relevantargs.begin(), relevantargs.end());
 
+	SpilledTemporaryList spilled;
+	SpillLiveTemporaries(PendingValues, spilled);
+
 	llvm::CallInst* inst = LLVMBuilder.CreateCall(target, relevantargs);
+	ReloadLiveTemporaries(spilled);
 
 	if(inst->getType() != Type::getVoidTy(getGlobalContext()))
 		PendingValues.push_back(inst);
@@ -801,7 +1051,11 @@ llvm::CallInst* Context::CodeCreateCallThunk(llvm::GlobalVariable* target)
 	}
 	std::reverse(relevantargs.begin(), relevantargs.end());
 
+	SpilledTemporaryList spilled;
+	SpillLiveTemporaries(PendingValues, spilled);
+
 	llvm::CallInst* inst = LLVMBuilder.CreateCall(loadedTarget, relevantargs);
+	ReloadLiveTemporaries(spilled);
 
 	if(inst->getType() != Type::getVoidTy(getGlobalContext()))
 		PendingValues.push_back(inst);
@@ -809,6 +1063,35 @@ llvm::CallInst* Context::CodeCreateCallThunk(llvm::GlobalVariable* target)
 	return inst;
 }
 
+//
+// Join the top count strings on the value stack with one call to the
+// runtime, in place of a chain of two-way concatenations that would
+// each allocate a partial result. The thunk is variadic, taking the
+// number of parts followed by the parts themselves.
+//
+void Context::CodeCreateStringConcat(unsigned count)
+{
+	Type* int32type = Type::getInt32Ty(getGlobalContext());
+	FunctionType* concattype = FunctionType::get(TypeGetString(), { int32type }, true);
+	GlobalVariable* concatthunk = FunctionCreateThunk("ERT_string_concat_n", concattype);
+
+	std::vector<Value*> args(count + 1);
+	args[0] = ConstantInt::get(int32type, count);
+	for(unsigned i = count; i > 0; --i)
+	{
+		args[i] = PendingValues.back();
+		PendingValues.pop_back();
+	}
+
+	SpilledTemporaryList spilled;
+	SpillLiveTemporaries(PendingValues, spilled);
+
+	llvm::CallInst* inst = LLVMBuilder.CreateCall(LLVMBuilder.CreateLoad(concatthunk), args);
+	ReloadLiveTemporaries(spilled);
+
+	PendingValues.push_back(inst);
+}
+
 void Context::CodeCreateCast(Type* targettype)
 {
 	llvm::Value* v = PendingValues.back();
@@ -906,10 +1189,10 @@ void* Context::CodeCreateReadArray(llvm::AllocaInst* allocatarget)
 
 void Context::CodeCreateReadParam(unsigned index)
 {
-	auto iter = LLVMBuilder.GetInsertBlock()->getParent()->arg_begin();
-	std::advance(iter, index);
+	Value* rv = GetParamStorage(index);
+	if(isa<AllocaInst>(rv))
+		rv = LLVMBuilder.CreateLoad(rv);
 
-	Value* rv = static_cast<Argument*>(iter);
 	PendingValues.push_back(rv);
 }
 
@@ -1000,10 +1283,7 @@ void Context::CodeCreateWriteIndirect(llvm::AllocaInst* allocatarget)
 
 void Context::CodeCreateWriteParam(unsigned index)
 {
-	auto iter = LLVMBuilder.GetInsertBlock()->getParent()->arg_begin();
-	std::advance(iter, index);
-
-	Value* pv = static_cast<Argument*>(iter);
+	Value* pv = GetParamStorage(index);
 
 	Value* wv = PendingValues.back();
 	PendingValues.pop_back();
@@ -1057,10 +1337,10 @@ void Context::CodeCreateWriteStructurePopSumType()
 	Value* st = ConstantStruct::get(cast<StructType>(ty), annotation, ConstantInt::get(ty->getContainedType(1), 0), nullptr);
 
 	// TODO - this is a stupid hack
-	Value* allocavalue = cast<LoadInst>(wv)->getOperand(0);
+	Value* allocavalue = BoxSumTypePayload(cast<LoadInst>(wv)->getOperand(0), nullptr);
 	Value* castvalue = LLVMBuilder.CreatePtrToInt(allocavalue, ty->getContainedType(1));
 
-	LLVMBuilder.CreateInsertValue(st, castvalue, { 1u });
+	st = LLVMBuilder.CreateInsertValue(st, castvalue, { 1u });
 	LLVMBuilder.CreateStore(st, gep);
 }
 
@@ -1326,6 +1606,21 @@ void Context::StructureTypeQueueMember(llvm::Type* t)
 	PendingMemberTypes.push_back(t);
 }
 
+void Context::StructureTypeQueueMemberTypeID(unsigned membertypeid)
+{
+	PendingMemberTypeIDs.push_back(membertypeid);
+}
+
+//
+// Optional; structures that are never registered are simply not
+// traced by the collector.
+//
+void Context::StructureTypeRegisterGC(llvm::Type* structtype, unsigned structtypeid)
+{
+	GCCompilation::RegisterStructureType(structtypeid, cast<StructType>(structtype), PendingMemberTypeIDs);
+	PendingMemberTypeIDs.clear();
+}
+
 
 
 void Context::SectionCopyPData(void* buffer) const
@@ -1455,6 +1750,12 @@ llvm::Type* Context::SumTypeCreate(const char* name, unsigned width)
 }
 
 
+void Context::SumTypeRegisterGC(llvm::Type* sumtype, unsigned sumtypeid)
+{
+	GCCompilation::RegisterSumType(sumtypeid, cast<StructType>(sumtype));
+}
+
+
 void Context::SumTypeMerge()
 {
 	PendingValues.push_back(nullptr);
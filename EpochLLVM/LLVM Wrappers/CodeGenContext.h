@@ -65,8 +65,11 @@ namespace CodeGen
 
 		llvm::Type* StructureTypeCreate(const char* name);
 		void StructureTypeQueueMember(llvm::Type* membertype);
+		void StructureTypeQueueMemberTypeID(unsigned membertypeid);
+		void StructureTypeRegisterGC(llvm::Type* structtype, unsigned structtypeid);
 
 		llvm::Type* SumTypeCreate(const char* name, unsigned width);
+		void SumTypeRegisterGC(llvm::Type* sumtype, unsigned sumtypeid);
 
 	public:		// Function management interface
 		llvm::Function* FunctionCreate(const char* name, llvm::FunctionType* fty);
@@ -78,6 +81,8 @@ namespace CodeGen
 		llvm::AllocaInst * CodeCreateAlloca(llvm::Type* vartype, const char* varname);
 		llvm::BasicBlock* CodeCreateBasicBlock(llvm::Function* parent, bool setinsertpoint);
 		void CodeCreateBranch(llvm::BasicBlock* target, bool setinsertpoint);
+		void CodeCreateBufferRead(llvm::Type* resulttype, unsigned bytes);
+		void CodeCreateBufferWrite(unsigned bytes);
 		llvm::CallInst* CodeCreateCall(llvm::Function* target);
 		void CodeCreateCallIndirect(llvm::AllocaInst* target);
 		llvm::CallInst* CodeCreateCallThunk(llvm::GlobalVariable* target);
@@ -92,6 +97,7 @@ namespace CodeGen
 		void CodeCreateReadStructure(llvm::Value* gep);
 		void CodeCreateRet();
 		void CodeCreateRetVoid();
+		void CodeCreateStringConcat(unsigned count);
 		void CodeCreateWrite(llvm::AllocaInst* allocatarget);
 		void CodeCreateWrite(llvm::GlobalVariable* globaltarget);
 		void CodeCreateWriteIndirect(llvm::AllocaInst* allocatarget);
@@ -165,6 +171,18 @@ namespace CodeGen
 		void SetupDebugInfo(llvm::Function* function);
 		void TagDebugLine(unsigned line, unsigned column);
 
+		typedef std::vector<std::pair<llvm::Value**, llvm::AllocaInst*>> SpilledTemporaryList;
+
+		void CodeCreateGCRoot(llvm::AllocaInst* root, uint32_t epochtypeid);
+		llvm::AllocaInst* CodeCreateRootedTemporary(uint32_t epochtypeid);
+		llvm::Value* BoxSumTypePayload(llvm::Value* payload, std::vector<llvm::Value*>* liveargs);
+
+		void SpillLiveTemporaries(std::vector<llvm::Value*>& values, SpilledTemporaryList& spilled);
+		void ReloadLiveTemporaries(const SpilledTemporaryList& spilled);
+
+		llvm::Value* GetParamStorage(unsigned index);
+		llvm::Value* GetCheckedBufferAddress(llvm::Value* buffer, llvm::Value* offset, llvm::Type* accesstype, unsigned bytes);
+
 	private:	// Internal state
 		std::unique_ptr<llvm::Module> LLVMModule;
 		llvm::Function* InitFunction;
@@ -183,8 +201,13 @@ namespace CodeGen
 
 		std::vector<std::vector<llvm::Type*>> PendingParamTypeStack;
 		std::vector<llvm::Type*> PendingMemberTypes;
+		std::vector<uint32_t> PendingMemberTypeIDs;
 		std::vector<llvm::Value*> PendingValues;
 
+		llvm::Function* TemporarySlotOwner = nullptr;
+		std::vector<llvm::AllocaInst*> TemporarySlots;
+		std::map<llvm::Argument*, llvm::AllocaInst*> ParamRootSlots;
+
 		std::map<unsigned, llvm::GlobalVariable*> CachedStrings;
 		std::map<std::string, llvm::GlobalVariable*> CachedThunkFunctions;
 
@@ -29,6 +29,19 @@ namespace
 	};
 
 
+	//
+	// Epoch type of each structure and sum type the program uses,
+	// so that the runtime can trace through their contents. Member
+	// type IDs line up with the LLVM structure's elements.
+	//
+	struct GCTypeInfo
+	{
+		uint32_t TypeID;
+		StructType* Type;
+		std::vector<uint32_t> MemberTypeIDs;
+	};
+
+
 	struct GCData
 	{
 		~GCData()
@@ -39,12 +52,42 @@ namespace
 
 		std::vector<GCRootData*> RootData;
 		std::vector<GCLiveRootInfo> LiveRootCache;
+
+		std::vector<GCTypeInfo> TypeInfo;
+		std::map<const Type*, uint32_t> TypeIDs;
 	};
 
 
 	GCData CompilationGCData;
 
 
+	const uint32_t StringTypeID = 0x02000000;
+	const uint32_t BufferTypeID = 0x02000001;
+	const uint32_t StringBuilderTypeID = 0x02000002;
+	const uint32_t ReferenceFlag = 0x80000000;
+
+	bool IsStructureTypeID(uint32_t epochtype)
+	{
+		uint32_t family = epochtype & 0x7f000000;
+		return (family == 0x03000000) || (family == 0x08000000);
+	}
+
+	bool IsSumTypeID(uint32_t epochtype)
+	{
+		return (epochtype & 0x7f000000) == 0x07000000;
+	}
+
+	//
+	// Only members that can lead into the collected heap are worth a
+	// layout entry; integers and function pointers are skipped entirely.
+	//
+	bool IsTracedTypeID(uint32_t epochtype)
+	{
+		uint32_t basetype = epochtype & ~ReferenceFlag;
+		return (basetype == StringTypeID) || (basetype == BufferTypeID) || (basetype == StringBuilderTypeID) || IsStructureTypeID(basetype) || IsSumTypeID(basetype);
+	}
+
+
 	class LLVM_LIBRARY_VISIBILITY EpochGCStrategy : public GCStrategy
 	{
 	public:
@@ -119,11 +162,76 @@ namespace
 
 
 
+void GCCompilation::RegisterStructureType(uint32_t epochtype, StructType* type, const std::vector<uint32_t>& membertypeids)
+{
+	assert(type->getNumElements() == membertypeids.size());
+
+	GCTypeInfo info;
+	info.TypeID = epochtype;
+	info.Type = type;
+	info.MemberTypeIDs = membertypeids;
+
+	CompilationGCData.TypeInfo.push_back(info);
+	CompilationGCData.TypeIDs[type] = epochtype;
+}
+
+//
+// A sum type is a { tag, payload } pair, where the tag is the Epoch
+// type of the value held and the payload is the address of it. The
+// runtime needs only the payload offset, which is described as a
+// single member with no type of its own.
+//
+void GCCompilation::RegisterSumType(uint32_t epochtype, StructType* type)
+{
+	GCTypeInfo info;
+	info.TypeID = epochtype;
+	info.Type = type;
+	info.MemberTypeIDs.push_back(0);
+	info.MemberTypeIDs.push_back(0);
+
+	CompilationGCData.TypeInfo.push_back(info);
+	CompilationGCData.TypeIDs[type] = epochtype;
+}
+
+uint32_t GCCompilation::GetTypeID(const Type* type)
+{
+	auto iter = CompilationGCData.TypeIDs.find(type);
+	if(iter == CompilationGCData.TypeIDs.end())
+		return 0;
+
+	return iter->second;
+}
+
+bool GCCompilation::IsStructureType(const Type* type)
+{
+	return IsStructureTypeID(GetTypeID(type));
+}
+
+
+//
+// Serialize the collected safepoint data into the image's GC section.
+//
+// Safepoint records are emitted sorted by return address so that the
+// runtime can locate the record for a stack frame with a binary search
+// rather than a scan of every safepoint in the program. Root records
+// are referenced by index and are therefore unaffected by the sort.
+//
+// The type layout table follows the roots, sorted by type ID. Each
+// layout lists the offsets of the members the collector must visit;
+// sum types list only their payload, with a member type ID of zero.
+//
 void GCCompilation::PrepareGCData(llvm::ExecutionEngine& ee, std::vector<char>* sectiondata)
 {
-	sectiondata->clear();
+	struct SafePointRecord
+	{
+		uint32_t ReturnIP;
+		uint32_t StackFrameSize;
+		uint32_t RootsIndex;
+		uint32_t RootsCount;
+	};
 
-	AppendToBuffer(sectiondata, static_cast<uint32_t>(CompilationGCData.RootData.size()));
+	std::vector<SafePointRecord> safepoints;
+	safepoints.reserve(CompilationGCData.RootData.size());
 
 	for(auto rd : CompilationGCData.RootData)
 	{
@@ -131,16 +239,110 @@ void GCCompilation::PrepareGCData(llvm::ExecutionEngine& ee, std::vector<char>*
 		const char* funcentryaddr = reinterpret_cast<const char*>(funcraw);
 		const char* safepointip = funcentryaddr + rd->LabelOffset - 0x400000;
 
-		AppendToBuffer(sectiondata, static_cast<uint32_t>(reinterpret_cast<uint64_t>(safepointip)));
-		AppendToBuffer(sectiondata, static_cast<uint32_t>(rd->StackFrameSize));
-		AppendToBuffer(sectiondata, static_cast<uint32_t>(rd->RootsIndex));
-		AppendToBuffer(sectiondata, static_cast<uint32_t>(rd->RootsCount));
+		SafePointRecord record;
+		record.ReturnIP = static_cast<uint32_t>(reinterpret_cast<uint64_t>(safepointip));
+		record.StackFrameSize = static_cast<uint32_t>(rd->StackFrameSize);
+		record.RootsIndex = rd->RootsIndex;
+		record.RootsCount = rd->RootsCount;
+
+		safepoints.push_back(record);
+	}
+
+	std::stable_sort(safepoints.begin(), safepoints.end(), [](const SafePointRecord& a, const SafePointRecord& b) {
+		return a.ReturnIP < b.ReturnIP;
+	});
+
+
+	struct TypeLayoutRecord
+	{
+		uint32_t TypeID;
+		uint32_t Size;
+		uint32_t FieldsIndex;
+		uint32_t FieldsCount;
+	};
+
+	struct FieldRecord
+	{
+		uint32_t Offset;
+		uint32_t TypeID;
+	};
+
+	std::vector<TypeLayoutRecord> layouts;
+	std::vector<FieldRecord> fields;
+
+	const DataLayout& datalayout = ee.getDataLayout();
+	for(const auto& info : CompilationGCData.TypeInfo)
+	{
+		const StructLayout* structlayout = datalayout.getStructLayout(info.Type);
+
+		TypeLayoutRecord layout;
+		layout.TypeID = info.TypeID;
+		layout.Size = static_cast<uint32_t>(structlayout->getSizeInBytes());
+		layout.FieldsIndex = static_cast<uint32_t>(fields.size());
+
+		if(IsSumTypeID(info.TypeID))
+		{
+			FieldRecord payload;
+			payload.Offset = static_cast<uint32_t>(structlayout->getElementOffset(1));
+			payload.TypeID = 0;
+			fields.push_back(payload);
+		}
+		else
+		{
+			for(unsigned i = 0; i < info.MemberTypeIDs.size(); ++i)
+			{
+				if(!IsTracedTypeID(info.MemberTypeIDs[i]))
+					continue;
+
+				FieldRecord field;
+				field.Offset = static_cast<uint32_t>(structlayout->getElementOffset(i));
+				field.TypeID = info.MemberTypeIDs[i];
+				fields.push_back(field);
+			}
+		}
+
+		layout.FieldsCount = static_cast<uint32_t>(fields.size()) - layout.FieldsIndex;
+		layouts.push_back(layout);
+	}
+
+	std::stable_sort(layouts.begin(), layouts.end(), [](const TypeLayoutRecord& a, const TypeLayoutRecord& b) {
+		return a.TypeID < b.TypeID;
+	});
+
+
+	sectiondata->clear();
+
+	AppendToBuffer(sectiondata, static_cast<uint32_t>(safepoints.size()));
+	AppendToBuffer(sectiondata, static_cast<uint32_t>(CompilationGCData.LiveRootCache.size()));
+	AppendToBuffer(sectiondata, static_cast<uint32_t>(layouts.size()));
+	AppendToBuffer(sectiondata, static_cast<uint32_t>(fields.size()));
+
+	for(const auto& record : safepoints)
+	{
+		AppendToBuffer(sectiondata, record.ReturnIP);
+		AppendToBuffer(sectiondata, record.StackFrameSize);
+		AppendToBuffer(sectiondata, record.RootsIndex);
+		AppendToBuffer(sectiondata, record.RootsCount);
 	}
 
 	for(const auto& root : CompilationGCData.LiveRootCache)
 	{
 		AppendToBuffer(sectiondata, root);
 	}
+
+	for(const auto& layout : layouts)
+	{
+		AppendToBuffer(sectiondata, layout.TypeID);
+		AppendToBuffer(sectiondata, layout.Size);
+		AppendToBuffer(sectiondata, layout.FieldsIndex);
+		AppendToBuffer(sectiondata, layout.FieldsCount);
+	}
+
+	for(const auto& field : fields)
+	{
+		AppendToBuffer(sectiondata, field.Offset);
+		AppendToBuffer(sectiondata, field.TypeID);
+	}
 }
 
 
@@ -4,12 +4,20 @@
 namespace llvm
 {
 	class ExecutionEngine;
+	class StructType;
+	class Type;
 }
 
 
 namespace GCCompilation
 {
 
+	void RegisterStructureType(uint32_t epochtype, llvm::StructType* type, const std::vector<uint32_t>& membertypeids);
+	void RegisterSumType(uint32_t epochtype, llvm::StructType* type);
+
+	uint32_t GetTypeID(const llvm::Type* type);
+	bool IsStructureType(const llvm::Type* type);
+
 	void PrepareGCData(llvm::ExecutionEngine& ee, std::vector<char>* sectiondata);
 
 }
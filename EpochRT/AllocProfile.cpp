@@ -0,0 +1,248 @@
+#include "stdafx.h"
+#include "AllocProfile.h"
+
+
+#include <cmath>
+#include <cstdio>
+#include <iomanip>
+
+
+
+SymbolTable::SymbolTable()
+	: TextBase(0)
+{
+}
+
+
+//
+// The file is a bare COFF symbol table: an array of IMAGE_SYMBOL
+// records followed by the string table that their names point into.
+// The record count is not stored, so we look for the one boundary
+// at which the string table's size field agrees with the size of
+// what is left of the file.
+//
+bool SymbolTable::Load(const std::string& filename, uint64_t textbase)
+{
+	FILE* file = fopen(filename.c_str(), "rb");
+	if(!file)
+		return false;
+
+	std::vector<char> data;
+	char buffer[4096];
+	size_t read;
+	while((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		data.insert(data.end(), buffer, buffer + read);
+
+	fclose(file);
+
+	// The compiler's size field overstates the strings by 4 bytes
+	// beyond the usual COFF convention of counting itself
+	size_t count = 0;
+	bool found = false;
+	for(size_t offset = 0; offset + sizeof(uint32_t) <= data.size(); offset += IMAGE_SIZEOF_SYMBOL, ++count)
+	{
+		uint32_t stringsize;
+		memcpy(&stringsize, &data[offset], sizeof(stringsize));
+		if(stringsize == data.size() - offset + 4)
+		{
+			found = true;
+			break;
+		}
+	}
+
+	if(!found)
+		return false;
+
+	const char* strings = data.data() + count * IMAGE_SIZEOF_SYMBOL;
+	size_t stringsize = data.size() - count * IMAGE_SIZEOF_SYMBOL;
+
+	Symbols.clear();
+	for(size_t i = 0; i < count; ++i)
+	{
+		IMAGE_SYMBOL symbol;
+		memcpy(&symbol, &data[i * IMAGE_SIZEOF_SYMBOL], IMAGE_SIZEOF_SYMBOL);
+
+		if(symbol.Type != (IMAGE_SYM_DTYPE_FUNCTION << N_BTSHFT))
+			continue;
+
+		uint32_t nameoffset = symbol.N.LongName[1];
+		if(symbol.N.LongName[0] != 0 || nameoffset >= stringsize)
+			continue;
+
+		Symbol entry;
+		entry.Address = textbase + symbol.Value;
+		entry.Name.assign(strings + nameoffset, strnlen(strings + nameoffset, stringsize - nameoffset));
+		Symbols.push_back(entry);
+	}
+
+	std::sort(Symbols.begin(), Symbols.end(), [](const Symbol& lhs, const Symbol& rhs) {
+		return lhs.Address < rhs.Address;
+	});
+
+	TextBase = textbase;
+	return true;
+}
+
+
+//
+// Name an address as function+offset, falling back to its offset
+// into the code when there is no symbol for it.
+//
+std::string SymbolTable::Describe(uint64_t address) const
+{
+	std::ostringstream out;
+
+	auto iter = std::upper_bound(Symbols.begin(), Symbols.end(), address, [](uint64_t addr, const Symbol& symbol) {
+		return addr < symbol.Address;
+	});
+
+	if(iter == Symbols.begin())
+		out << ".text+0x" << std::hex << (address - TextBase);
+	else
+	{
+		--iter;
+		out << iter->Name << "+0x" << std::hex << (address - iter->Address);
+	}
+
+	return out.str();
+}
+
+
+
+AllocationProfile::AllocationProfile(size_t intervalbytes)
+	: IntervalBytes(intervalbytes)
+{
+}
+
+
+//
+// Take note of one sampled allocation. The frames are return
+// addresses into Epoch code, innermost first.
+//
+void AllocationProfile::Record(const char* s, size_t blocksize, const uint64_t* frames, unsigned framecount)
+{
+	framecount = std::min(framecount, MaxFrames);
+
+	std::vector<uint64_t> key(frames, frames + framecount);
+	auto inserted = SiteIndices.emplace(key, static_cast<uint32_t>(Sites.size()));
+	if(inserted.second)
+	{
+		Site site = Site();
+		std::copy(frames, frames + framecount, site.Frames);
+		site.FrameCount = framecount;
+		Sites.push_back(site);
+	}
+
+	// An allocation of this size is picked with probability p, so
+	// it stands for 1/p allocations like it
+	double p = 1.0 - std::exp(-static_cast<double>(blocksize) / IntervalBytes);
+
+	Sample sample;
+	sample.String = s;
+	sample.SiteIndex = inserted.first->second;
+	sample.Resolved = false;
+	sample.Weight = blocksize / p;
+
+	Site& site = Sites[sample.SiteIndex];
+	++site.Samples;
+	site.EstimatedBytes += sample.Weight;
+	site.EstimatedCount += 1.0 / p;
+	site.LiveBytes += sample.Weight;
+
+	Samples.push_back(sample);
+}
+
+
+std::string AllocationProfile::DescribeSite(const Site& site, const SymbolTable& symbols) const
+{
+	if(!site.FrameCount)
+		return "(no Epoch frames)";
+
+	std::string description;
+	for(unsigned i = 0; i < site.FrameCount; ++i)
+	{
+		if(i)
+			description += " <- ";
+
+		description += symbols.Describe(site.Frames[i]);
+	}
+
+	return description;
+}
+
+
+//
+// Sites in order of the bytes they allocated over the whole run.
+// Survival is the share of resolved samples that outlived their
+// first collection; a site whose strings mostly die young is churn
+// the nursery absorbs, while a site with high survival is what
+// fills the mature heap.
+//
+std::string AllocationProfile::Format(const SymbolTable& symbols) const
+{
+	std::vector<const Site*> sorted;
+	for(const Site& site : Sites)
+		sorted.push_back(&site);
+
+	std::sort(sorted.begin(), sorted.end(), [](const Site* lhs, const Site* rhs) {
+		return lhs->EstimatedBytes > rhs->EstimatedBytes;
+	});
+
+	std::ostringstream out;
+	out << "Allocation sites, sampled about every " << IntervalBytes << " bytes:\n";
+	out << std::setw(14) << "bytes" << std::setw(12) << "allocs" << std::setw(9) << "samples" << std::setw(10) << "survived" << "  site\n";
+
+	for(const Site* site : sorted)
+	{
+		out << std::setw(14) << static_cast<uint64_t>(site->EstimatedBytes)
+			<< std::setw(12) << static_cast<uint64_t>(site->EstimatedCount)
+			<< std::setw(9) << site->Samples;
+
+		if(site->Resolved)
+			out << std::setw(9) << (site->Survived * 100 / site->Resolved) << "%";
+		else
+			out << std::setw(10) << "-";
+
+		out << "  " << DescribeSite(*site, symbols) << "\n";
+	}
+
+	return out.str();
+}
+
+
+//
+// Change in estimated live bytes per site since the previous call
+// (or since the start of the run). Liveness is only as fresh as the
+// last collection, so callers wanting an exact picture should
+// collect first.
+//
+std::string AllocationProfile::FormatSnapshotDiff(const SymbolTable& symbols)
+{
+	std::vector<std::pair<double, const Site*>> changes;
+	for(Site& site : Sites)
+	{
+		double delta = site.LiveBytes - site.SnapshotBytes;
+		site.SnapshotBytes = site.LiveBytes;
+
+		if(static_cast<int64_t>(delta) != 0)
+			changes.emplace_back(delta, &site);
+	}
+
+	std::sort(changes.begin(), changes.end(), [](const std::pair<double, const Site*>& lhs, const std::pair<double, const Site*>& rhs) {
+		return std::abs(lhs.first) > std::abs(rhs.first);
+	});
+
+	std::ostringstream out;
+	out << "Live bytes by allocation site, change since last snapshot:\n";
+	out << std::setw(14) << "change" << std::setw(14) << "live" << "  site\n";
+
+	for(const auto& change : changes)
+	{
+		out << std::setw(14) << std::showpos << static_cast<int64_t>(change.first) << std::noshowpos
+			<< std::setw(14) << static_cast<int64_t>(change.second->LiveBytes)
+			<< "  " << DescribeSite(*change.second, symbols) << "\n";
+	}
+
+	return out.str();
+}
+
@@ -0,0 +1,157 @@
+#pragma once
+
+
+#include <map>
+
+
+//
+// Function symbols for compiled Epoch code
+//
+// The compiler writes the COFF symbol table for the program's code
+// to a .sym file next to the executable. Symbol values are offsets
+// into the .text section, so addresses are looked up relative to
+// where that section was loaded.
+//
+class SymbolTable
+{
+public:
+	SymbolTable();
+
+public:
+	bool Load(const std::string& filename, uint64_t textbase);
+
+	std::string Describe(uint64_t address) const;
+
+private:
+	struct Symbol
+	{
+		uint64_t Address;
+		std::string Name;
+	};
+
+	std::vector<Symbol> Symbols;
+	uint64_t TextBase;
+};
+
+
+
+//
+// Sampled record of which Epoch call sites allocate strings
+//
+// Roughly one allocation per interval bytes is sampled, at random
+// so that a loop allocating in a fixed pattern cannot keep dodging
+// (or hitting) the sampler. Each sample carries the return addresses
+// of the Epoch frames above the allocation, and is weighted by the
+// inverse of its chance of being picked, so the per-site totals are
+// unbiased estimates of the real ones.
+//
+// Sampled strings are then followed through the collector. A sample
+// counts as surviving if it is still reachable at the first
+// collection that looks at it: the next collection of any kind for
+// a nursery string, the next major one for a string allocated
+// mature. Live samples also give an estimate of the bytes each site
+// is currently holding on to, which is what snapshots compare.
+//
+class AllocationProfile
+{
+public:
+	explicit AllocationProfile(size_t intervalbytes);
+
+public:
+	enum SampleState
+	{
+		SampleDead,
+		SampleLive,
+		SampleNotTraced
+	};
+
+	size_t GetIntervalBytes() const
+	{
+		return IntervalBytes;
+	}
+
+	void Record(const char* s, size_t blocksize, const uint64_t* frames, unsigned framecount);
+
+	template<typename UpdateT>
+	void UpdateSamples(UpdateT update);
+
+	std::string Format(const SymbolTable& symbols) const;
+	std::string FormatSnapshotDiff(const SymbolTable& symbols);
+
+public:
+	static const unsigned MaxFrames = 8;
+
+private:
+	struct Site
+	{
+		uint64_t Frames[MaxFrames];
+		unsigned FrameCount;
+
+		uint64_t Samples;
+		double EstimatedBytes;
+		double EstimatedCount;
+
+		uint64_t Resolved;
+		uint64_t Survived;
+
+		double LiveBytes;
+		double SnapshotBytes;
+	};
+
+	struct Sample
+	{
+		const char* String;
+		uint32_t SiteIndex;
+		bool Resolved;
+		double Weight;
+	};
+
+	std::string DescribeSite(const Site& site, const SymbolTable& symbols) const;
+
+private:
+	size_t IntervalBytes;
+
+	std::vector<Site> Sites;
+	std::map<std::vector<uint64_t>, uint32_t> SiteIndices;
+
+	std::vector<Sample> Samples;
+};
+
+
+
+//
+// Visit every sample still being followed. The update function
+// gets a reference to the sampled string, which it redirects if the
+// collector moved the string, and says whether the string is dead,
+// live, or was not looked at by this collection.
+//
+template<typename UpdateT>
+void AllocationProfile::UpdateSamples(UpdateT update)
+{
+	auto end = std::remove_if(Samples.begin(), Samples.end(), [this, &update](Sample& sample) {
+		SampleState state = update(sample.String);
+		if(state == SampleNotTraced)
+			return false;
+
+		Site& site = Sites[sample.SiteIndex];
+		if(!sample.Resolved)
+		{
+			sample.Resolved = true;
+			++site.Resolved;
+
+			if(state == SampleLive)
+				++site.Survived;
+		}
+
+		if(state == SampleDead)
+		{
+			site.LiveBytes -= sample.Weight;
+			return true;
+		}
+
+		return false;
+	});
+
+	Samples.erase(end, Samples.end());
+}
+
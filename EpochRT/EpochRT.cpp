@@ -2,54 +2,458 @@
 //
 
 #include "stdafx.h"
-#include <iostream>
+#include <cstdarg>
+#include <limits>
 
 #include "StringPool.h"
 #include "GC.h"
+#include "StackWalk.h"
+#include "StringScan.h"
+#include "NumberFormat.h"
+#include "Output.h"
 
 
-// TODO - thread safety
-ThreadStringPool StringPool;
+namespace
+{
+
+	struct ThreadStartData
+	{
+		void (*Entry)(int);
+		int Param;
+	};
+
+	DWORD WINAPI ThreadTrampoline(void* param)
+	{
+		ThreadStartData data = *reinterpret_cast<ThreadStartData*>(param);
+		delete reinterpret_cast<ThreadStartData*>(param);
+
+		// Anything deeper than this local belongs to the new thread's
+		// Epoch code, so it makes a good upper bound for stack walks
+		uint64_t stackbase = 0;
+		GC::AttachThread(reinterpret_cast<uint64_t>(&stackbase));
+
+		data.Entry(data.Param);
+
+		GC::DetachThread();
+		return 0;
+	}
+
+
+	// One-character strings for every character value, so that
+	// picking a string apart a character at a time costs nothing
+	struct SingleCharacterTable
+	{
+		char Strings[256][2];
+
+		SingleCharacterTable()
+		{
+			for(unsigned i = 0; i < 256; ++i)
+			{
+				Strings[i][0] = static_cast<char>(i);
+				Strings[i][1] = 0;
+			}
+		}
+	};
+
+	const SingleCharacterTable SingleCharacters;
+
+
+	int ScanResult(size_t pos)
+	{
+		return pos == StringScan::NotFound ? -1 : static_cast<int>(pos);
+	}
+
+
+	const char* AllocFormattedInteger(int64_t value)
+	{
+		char digits[NumberFormat::MaxIntegerChars];
+		size_t length = NumberFormat::FormatInteger(digits, value);
+		return GC::GetThreadPool().Alloc(digits, length);
+	}
+
+	//
+	// Numbers are read after any leading whitespace, up to the first
+	// character that cannot continue them; anything that does not
+	// start with a number reads as zero.
+	//
+	const char* SkipLeadingWhitespace(const char* s, size_t& length)
+	{
+		const char* chars = ThreadStringPool::GetChars(s, length);
+
+		size_t start = StringScan::SkipClass(chars, length, StringScan::ClassWhitespace, 0);
+		if(start == StringScan::NotFound)
+			start = length;
+
+		length -= start;
+		return chars + start;
+	}
+
+	int64_t ParseIntegerString(const char* s, int64_t minvalue, int64_t maxvalue)
+	{
+		size_t length;
+		const char* chars = SkipLeadingWhitespace(s, length);
+
+		int64_t value = 0;
+		NumberFormat::ParseInteger(chars, length, minvalue, maxvalue, value);
+		return value;
+	}
+
+
+	//
+	// Size in bytes of a buffer, or zero for one that was never
+	// allocated
+	//
+	size_t GetBufferSize(const char* buffer)
+	{
+		const StringHeader* header = ThreadStringPool::FindHeader(buffer);
+		return header ? header->Length : 0;
+	}
+
+	//
+	// Reading or writing outside a buffer ends the program the way a
+	// failed assertion does, after saying where it went wrong
+	//
+	[[noreturn]] void FailBufferAccess(const char* buffer, unsigned pos, unsigned count)
+	{
+		char message[128];
+		snprintf(message, sizeof(message), "Buffer access out of bounds: %u bytes at offset %u of a %u byte buffer", count, pos, static_cast<unsigned>(GetBufferSize(buffer)));
+
+		Output::WriteLine(Output::StandardError, message, strlen(message));
+		Output::FlushAll();
+		exit(0xffffffff);
+	}
+
+	char* GetBufferRange(const char* buffer, unsigned pos, unsigned count)
+	{
+		if(static_cast<uint64_t>(pos) + count > GetBufferSize(buffer))
+			FailBufferAccess(buffer, pos, count);
+
+		return const_cast<char*>(buffer) + pos;
+	}
+
+}
 
 
 extern "C" void ERT_assert(bool flag)
 {
 	// TODO - better handling here
 	if(!flag)
+	{
+		Output::FlushAll();
 		exit(0xffffffff);
+	}
 }
 
 extern "C" void ERT_passtest()
 {
-	std::cout << "TEST: pass" << std::endl;
+	static const char message[] = "TEST: pass";
+	Output::WriteLine(Output::StandardOutput, message, sizeof(message) - 1);
 }
 
 extern "C" const char* ERT_string_concat(const char* s1, const char* s2)
 {
-	return StringPool.AllocConcat(s1, s2);
+	GC_SAFEPOINT(&s1, &s2);
+	return GC::GetThreadPool().AllocConcat(s1, s2);
+}
+
+//
+// A whole chain of ; operators joined at once, so that none of the
+// partial results is ever built. The compiler emits this for chains
+// of three or more parts; literals next to each other in the chain
+// have already been folded together by then.
+//
+extern "C" const char* ERT_string_concat_n(int count, ...)
+{
+	const char* localparts[16];
+	std::vector<const char*> moreparts;
+
+	const char** parts = localparts;
+	if(count > 16)
+	{
+		moreparts.resize(count);
+		parts = moreparts.data();
+	}
+
+	va_list args;
+	va_start(args, count);
+	for(int i = 0; i < count; ++i)
+		parts[i] = va_arg(args, const char*);
+	va_end(args);
+
+	const char* result = GC::GetThreadPool().AllocConcat(parts, count);
+
+	// The parts are not rooted anywhere the collector could update
+	// them, so it has to wait until they have been copied
+	GC_SAFEPOINT(&result, nullptr);
+	return result;
+}
+
+
+//
+// Backing for the stringbuilder type. As with buffers, the builder
+// is collected once no variable holds it. Its storage goes with the
+// finished string, or with the builder if it is never finished.
+//
+extern "C" void ERT_stringbuilder_alloc(StringBuilder** outbuilder, unsigned capacity)
+{
+	GC_SAFEPOINT(nullptr, nullptr);
+
+	StringBuilder* builder = GC::GetThreadPool().AllocBuilder();
+	builder->Reserve(capacity);
+	*outbuilder = builder;
+}
+
+extern "C" void ERT_stringbuilder_append(StringBuilder* builder, const char* s)
+{
+	size_t length;
+	const char* chars = ThreadStringPool::GetChars(s, length);
+	builder->Append(chars, length);
+	GC_SAFEPOINT(nullptr, nullptr);
+}
+
+extern "C" void ERT_stringbuilder_append_integer(StringBuilder* builder, int value)
+{
+	builder->AppendInteger(value);
+	GC_SAFEPOINT(nullptr, nullptr);
+}
+
+extern "C" void ERT_stringbuilder_append_real(StringBuilder* builder, float value)
+{
+	builder->AppendReal(value);
+	GC_SAFEPOINT(nullptr, nullptr);
+}
+
+extern "C" void ERT_stringbuilder_reserve(StringBuilder* builder, int capacity)
+{
+	if(capacity > 0)
+		builder->Reserve(static_cast<size_t>(capacity));
+}
+
+extern "C" int ERT_stringbuilder_length(StringBuilder* builder)
+{
+	return static_cast<int>(builder->GetLength());
+}
+
+extern "C" const char* ERT_stringbuilder_finish(StringBuilder* builder)
+{
+	const char* result = builder->Finish();
+
+	// No longer a builder root, so it has to be pinned until returned
+	GC_SAFEPOINT(&result, nullptr);
+	return result;
+}
+
+//
+// The one string shared by everything interned with the same
+// contents. Comparing two interned strings only compares pointers.
+// The intern table does not keep its strings alive by itself.
+//
+extern "C" const char* ERT_intern(const char* s)
+{
+	GC_SAFEPOINT(&s, nullptr);
+	return GC::Intern(s);
 }
 
 extern "C" bool ERT_string_compare(const char* s1, const char* s2)
 {
-	return (std::strcmp(s1, s2) == 0);
+	return ThreadStringPool::Equals(s1, s2);
+}
+
+extern "C" bool ERT_string_equals(const char* s1, const char* s2)
+{
+	return ThreadStringPool::Equals(s1, s2);
+}
+
+extern "C" int ERT_string_length(const char* s)
+{
+	return static_cast<int>(ThreadStringPool::GetLength(s));
+}
+
+//
+// Offset of the first occurrence of needle at or after start, or
+// -1 if there is none
+//
+extern "C" int ERT_string_find(const char* haystack, const char* needle, int start)
+{
+	if(start < 0)
+		start = 0;
+
+	size_t length;
+	size_t needlelength;
+	const char* chars = ThreadStringPool::GetChars(haystack, length);
+	const char* needlechars = ThreadStringPool::GetChars(needle, needlelength);
+	return ScanResult(StringScan::Find(chars, length, needlechars, needlelength, start));
+}
+
+//
+// Offset of the first character at or after start that appears
+// anywhere in set, or -1
+//
+extern "C" int ERT_string_find_any(const char* s, const char* set, int start)
+{
+	if(start < 0)
+		start = 0;
+
+	size_t length;
+	size_t setlength;
+	const char* chars = ThreadStringPool::GetChars(s, length);
+	const char* setchars = ThreadStringPool::GetChars(set, setlength);
+	return ScanResult(StringScan::FindAnyOf(chars, length, setchars, setlength, start));
+}
+
+//
+// Offset of the first character at or after start that is in none
+// of the given classes (1 whitespace, 2 digits, 4 letters, 8 the
+// underscore), or -1 if the rest of the string is all made of them
+//
+extern "C" int ERT_string_skip_class(const char* s, int classes, int start)
+{
+	if(start < 0)
+		start = 0;
+
+	size_t length;
+	const char* chars = ThreadStringPool::GetChars(s, length);
+	return ScanResult(StringScan::SkipClass(chars, length, static_cast<unsigned>(classes), start));
+}
+
+//
+// The piece of s from start up to (not including) the next of the
+// delimiter characters, or to the end. Splitting a whole string is
+// a matter of stepping start past each chunk and its delimiter.
+//
+extern "C" const char* ERT_string_split_chunk(const char* s, const char* delimiters, int start)
+{
+	GC_SAFEPOINT(&s, &delimiters);
+
+	size_t length;
+	const char* chars = ThreadStringPool::GetChars(s, length);
+	if(start < 0)
+		start = 0;
+
+	if(static_cast<size_t>(start) >= length)
+		return "";
+
+	size_t setlength;
+	const char* setchars = ThreadStringPool::GetChars(delimiters, setlength);
+
+	size_t end = StringScan::FindAnyOf(chars, length, setchars, setlength, start);
+	if(end == StringScan::NotFound)
+		end = length;
+
+	return GC::GetThreadPool().AllocSubstring(s, start, end - start);
+}
+
+//
+// The character at index as a string of its own, or an empty string
+// when index is out of range. Nothing is allocated.
+//
+extern "C" const char* ERT_string_char_at(const char* s, int index)
+{
+	size_t length;
+	const char* chars = ThreadStringPool::GetChars(s, length);
+	if(index < 0 || static_cast<size_t>(index) >= length)
+		return "";
+
+	return SingleCharacters.Strings[static_cast<unsigned char>(chars[index])];
 }
 
 extern "C" const char* ERT_string_from_integer(int i)
 {
-	std::ostringstream convert;
-	convert << i;
+	GC_SAFEPOINT(nullptr, nullptr);
+	return AllocFormattedInteger(i);
+}
 
-	return StringPool.Alloc(convert.str());
+extern "C" const char* ERT_string_from_integer64(int64_t i)
+{
+	GC_SAFEPOINT(nullptr, nullptr);
+	return AllocFormattedInteger(i);
+}
+
+extern "C" const char* ERT_string_from_integer16(short i)
+{
+	GC_SAFEPOINT(nullptr, nullptr);
+	return AllocFormattedInteger(i);
 }
 
 extern "C" void ERT_gc_init(unsigned segmentoffset)
 {
-	GC::Init(segmentoffset);
+	GC::Init(segmentoffset, STACKWALK_CALLER_FRAME());
 }
 
 extern "C" void ERT_gc_collect_strings()
 {
-	GC::CollectStrings(&StringPool, _ReturnAddress());
+	GC::CollectStrings(STACKWALK_CALLER_FRAME());
+}
+
+//
+// Collector statistics as "name value" lines, the same text that
+// EPOCH_GC_SUMMARY prints at exit
+//
+extern "C" const char* ERT_gc_stats()
+{
+	GC_SAFEPOINT(nullptr, nullptr);
+	return GC::GetThreadPool().Alloc(GC::GetStatistics());
+}
+
+//
+// Estimated live bytes per allocation site, as the change since the
+// previous call; only available with EPOCH_GC_PROFILE_KB set. Call
+// ERT_gc_collect_strings first for an up to date picture.
+//
+extern "C" const char* ERT_gc_profile_snapshot()
+{
+	GC_SAFEPOINT(nullptr, nullptr);
+	return GC::GetThreadPool().Alloc(GC::GetProfileSnapshot());
+}
+
+//
+// Heap storage for a structure that has to outlive the frame it was
+// built in, such as one wrapped up in a sum type
+//
+extern "C" void* ERT_gc_alloc_structure(unsigned epochtype)
+{
+	GC_SAFEPOINT(nullptr, nullptr);
+	return GC::AllocStructure(epochtype);
+}
+
+//
+// Compiled code brackets calls to externals tagged blocking with
+// these, so that other threads can collect without waiting for the
+// call to return. Such a call must not run Epoch code before it
+// does, and its arguments must hold nothing the collector could
+// move (see ExternalUsesSafeRegion in the compiler).
+//
+extern "C" void ERT_gc_enter_safe_region()
+{
+	GC::EnterSafeRegion(STACKWALK_CALLER_FRAME());
+}
+
+extern "C" void ERT_gc_leave_safe_region()
+{
+	GC::LeaveSafeRegion();
+}
+
+
+extern "C" int ERT_thread_start(void (*entry)(int), int param)
+{
+	ThreadStartData* data = new ThreadStartData;
+	data->Entry = entry;
+	data->Param = param;
+
+	// Kernel handles are guaranteed to fit in 32 bits
+	HANDLE handle = ::CreateThread(NULL, 0, ThreadTrampoline, data, 0, NULL);
+	return static_cast<int>(reinterpret_cast<intptr_t>(handle));
+}
+
+extern "C" void ERT_thread_join(int thread)
+{
+	HANDLE handle = reinterpret_cast<HANDLE>(static_cast<intptr_t>(thread));
+
+	GC::EnterSafeRegion(STACKWALK_CALLER_FRAME());
+	::WaitForSingleObject(handle, INFINITE);
+	GC::LeaveSafeRegion();
+
+	::CloseHandle(handle);
 }
 
 
@@ -61,13 +465,135 @@ extern "C" short ERT_integer16_from_integer(int in)
 
 extern "C" void ERT_print(const char* out)
 {
-	std::cout << out << std::endl;
+	size_t length;
+	const char* chars = ThreadStringPool::GetChars(out, length);
+
+	Output::WriteLine(Output::StandardOutput, chars, length);
 }
 
+//
+// Push out anything print has buffered, which otherwise waits for a
+// full buffer or the end of the program unless the output is going
+// to a console
+//
+extern "C" void ERT_flush()
+{
+	Output::FlushAll();
+}
 
+
+//
+// Buffers are zero-filled blocks in the collected heap, which never
+// move; see ThreadStringPool::AllocBuffer(). Compiled code reads and
+// writes them in place, checking each access against the size kept
+// in the header, and calls ERT_buffer_bounds_failure when one misses.
+//
 extern "C" void ERT_buffer_alloc(char** outbuffer, unsigned size)
 {
-	*outbuffer = new char[size];
+	GC_SAFEPOINT(nullptr, nullptr);
+	*outbuffer = GC::GetThreadPool().AllocBuffer(size);
+}
+
+extern "C" void ERT_buffer_copy(char** outbuffer, const char* source)
+{
+	GC_SAFEPOINT(&source, nullptr);
+
+	size_t size = GetBufferSize(source);
+	char* copy = GC::GetThreadPool().AllocBuffer(size);
+	memcpy(copy, source, size);
+	*outbuffer = copy;
+}
+
+extern "C" unsigned ERT_buffer_length(const char* buffer)
+{
+	return static_cast<unsigned>(GetBufferSize(buffer));
+}
+
+extern "C" void ERT_buffer_bounds_failure(const char* buffer, unsigned pos, unsigned count)
+{
+	FailBufferAccess(buffer, pos, count);
+}
+
+extern "C" void ERT_buffer_fill(char* buffer, unsigned pos, int value, unsigned count)
+{
+	memset(GetBufferRange(buffer, pos, count), value, count);
+}
+
+//
+// The ranges may overlap, as when moving bytes within one buffer
+//
+extern "C" void ERT_buffer_move(char* dest, unsigned destpos, const char* source, unsigned sourcepos, unsigned count)
+{
+	char* to = GetBufferRange(dest, destpos, count);
+	const char* from = GetBufferRange(source, sourcepos, count);
+	memmove(to, from, count);
+}
+
+extern "C" int ERT_buffer_compare(const char* a, unsigned apos, const char* b, unsigned bpos, unsigned count)
+{
+	int result = memcmp(GetBufferRange(a, apos, count), GetBufferRange(b, bpos, count), count);
+	return (result > 0) - (result < 0);
+}
+
+extern "C" void ERT_write_buffer(char** buffer, unsigned pos, int value)
+{
+	*GetBufferRange(*buffer, pos, 1) = static_cast<char>(value);
+}
+
+extern "C" void ERT_write_buffer_real(char** buffer, unsigned pos, float value)
+{
+	memcpy(GetBufferRange(*buffer, pos, sizeof(value)), &value, sizeof(value));
+}
+
+//
+// The string's characters and terminator, cut short or padded out
+// with zeroes to fill the given number of bytes
+//
+extern "C" void ERT_write_buffer_string(char** buffer, unsigned pos, const char* str, unsigned bytes)
+{
+	char* target = GetBufferRange(*buffer, pos, bytes);
+
+	size_t length;
+	const char* chars = ThreadStringPool::GetChars(str, length);
+
+	size_t copied = std::min<size_t>(length, bytes);
+	memcpy(target, chars, copied);
+	memset(target + copied, 0, bytes - copied);
+}
+
+//
+// Still imported by the EpochDevTools32 compiler; the 64-bit compiler
+// has no writebuffer overload that takes a raw source address, since
+// an Epoch integer cannot hold one. Read files with ERT_file_map and
+// copy the resulting string instead.
+//
+extern "C" void ERT_write_buffer_multiple()
+{
+}
+
+
+//
+// The contents of a file as a string, mapped in place rather than
+// copied wherever the file allows it; see ThreadStringPool::MapFile().
+// A file that cannot be read comes back empty, with a length of -1.
+//
+extern "C" const char* ERT_file_map(const char* filename, int* length)
+{
+	GC_SAFEPOINT(&filename, nullptr);
+
+	size_t namelength;
+	const char* namechars = ThreadStringPool::GetChars(filename, namelength);
+	std::string name(namechars, namelength);
+
+	const char* contents = GC::GetThreadPool().MapFile(name.c_str());
+	if(!contents)
+	{
+		*length = -1;
+		return "";
+	}
+
+	*length = static_cast<int>(ThreadStringPool::GetLength(contents));
+	return contents;
 }
 
 
@@ -76,15 +602,29 @@ extern "C" char EpochLib_SubstrCharDirect(const char* p, int pos)
 	return p[pos];
 }
 
+//
+// A slice hands out the characters of its base, which is what gets
+// pinned. The pointer is only good for reading within the length.
+//
 extern "C" const char* EpochLib_StrPointer(const char* s)
 {
-	return s;
+	if(const SliceData* slice = ThreadStringPool::FindSlice(s))
+		return GC::Pin(slice->Base) + slice->Offset;
+
+	return GC::Pin(s);
 }
 
+//
+// The pointer comes from EpochLib_StrPointer and may be partway into
+// a string, so it cannot be sliced; the tokens taken this way are
+// short enough that copying them costs no more than a slice would.
+//
 extern "C" const char* EpochLib_SubstrDirect(const char* p, int pos, int len)
 {
-	std::string s(p + pos, len);
-	return StringPool.Alloc(s);
+	const char* result = GC::GetThreadPool().Alloc(p + pos, len);
+
+	GC_SAFEPOINT(&result, nullptr);
+	return result;
 }
 
 extern "C" bool ERT_cmdlineisvalid()
@@ -102,19 +642,28 @@ extern "C" const char* ERT_cmdlineget(unsigned index)
 	return "";
 }
 
+//
+// Substrings long enough to be worth it share the original's
+// characters instead of copying them; see AllocSubstring(). The
+// range is clipped to the string.
+//
 extern "C" const char* ERT_substring_length(const char* str, unsigned pos, unsigned length)
 {
-	std::string s(str + pos, length);
-	return StringPool.Alloc(s);
-}
+	GC_SAFEPOINT(&str, nullptr);
 
-extern "C" void ERT_write_buffer_real(char* buffer, float value)
-{
+	size_t strlength = ThreadStringPool::GetLength(str);
+	if(pos > strlength)
+		pos = static_cast<unsigned>(strlength);
+	if(length > strlength - pos)
+		length = static_cast<unsigned>(strlength - pos);
+
+	return GC::GetThreadPool().AllocSubstring(str, pos, length);
 }
 
 extern "C" char ERT_subchar(const char* str, unsigned pos)
 {
-	return str[pos];
+	size_t length;
+	return ThreadStringPool::GetChars(str, length)[pos];
 }
 
 extern "C" const char* ERT_widenfromptr(const char* p)
@@ -129,50 +678,80 @@ extern "C" const char* ERT_string_unescape(const char* in)
 
 extern "C" const char* ERT_string_narrow(const char* p)
 {
-	return p;
+	GC_SAFEPOINT(&p, nullptr);
+	return GC::GetThreadPool().Materialize(p);
 }
 
 extern "C" const char* ERT_substring_nolength(const char* str, unsigned pos)
 {
-	std::string s(str + pos);
-	return StringPool.Alloc(s);
-}
+	GC_SAFEPOINT(&str, nullptr);
 
-extern "C" float ERT_string_to_real(const char* p)
-{
-	return 0.0f;
-}
+	size_t strlength = ThreadStringPool::GetLength(str);
+	if(pos > strlength)
+		pos = static_cast<unsigned>(strlength);
 
-extern "C" void ERT_write_buffer_string(char* buffer, unsigned pos, const char* str)
-{
+	return GC::GetThreadPool().AllocSubstring(str, pos, strlength - pos);
 }
 
-extern "C" void ERT_write_buffer(char* buffer, unsigned pos, char value)
+//
+// A null terminated copy of a slice, for handing to native code that
+// knows nothing of slices. The compiler calls this on every string
+// passed to an external function outside the runtime.
+//
+extern "C" const char* ERT_string_materialize(const char* s)
 {
+	GC_SAFEPOINT(&s, nullptr);
+	return GC::GetThreadPool().Materialize(s);
 }
 
-extern "C" void ERT_write_buffer_multiple()
+extern "C" float ERT_string_to_real(const char* p)
 {
+	size_t length;
+	const char* chars = SkipLeadingWhitespace(p, length);
+
+	float value = 0.0f;
+	NumberFormat::ParseReal(chars, length, value);
+	return value;
 }
 
 extern "C" const char* ERT_real_to_string(float value)
 {
-	return "";
-}
+	GC_SAFEPOINT(nullptr, nullptr);
 
-extern "C" const char* ERT_buffer_copy(const char* buffer)
-{
-	return "";
+	char digits[NumberFormat::MaxRealChars];
+	size_t length = NumberFormat::FormatReal(digits, value);
+	return GC::GetThreadPool().Alloc(digits, length);
 }
 
 extern "C" int ERT_string_compare_notequal(const char* a, const char* b)
 {
+	if(ThreadStringPool::Equals(a, b))
+		return 0;
+
+	GC_SAFEPOINT(&a, &b);
+
+	ThreadStringPool& pool = GC::GetThreadPool();
+	a = pool.Materialize(a);
+	b = pool.Materialize(b);
 	return lstrcmpA(a, b);
 }
 
+//
+// Values beyond the range of the result are clamped to it
+//
 extern "C" int ERT_string_to_integer(const char* str)
 {
-	return 0;
+	return static_cast<int>(ParseIntegerString(str, std::numeric_limits<int>::min(), std::numeric_limits<int>::max()));
+}
+
+extern "C" int64_t ERT_string_to_integer64(const char* str)
+{
+	return ParseIntegerString(str, std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max());
+}
+
+extern "C" short ERT_string_to_integer16(const char* str)
+{
+	return static_cast<short>(ParseIntegerString(str, std::numeric_limits<short>::min(), std::numeric_limits<short>::max()));
 }
 
 
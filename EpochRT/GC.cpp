@@ -2,9 +2,21 @@
 #include "GC.h"
 
 #include "StringPool.h"
+#include "InternTable.h"
+#include "StackWalk.h"
+#include "GCStats.h"
+#include "AllocProfile.h"
 
 
-#include <DbgHelp.h>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <unordered_set>
+#include <unordered_map>
+#include <random>
+
+
+extern "C" IMAGE_DOS_HEADER __ImageBase;
 
 
 namespace
@@ -24,18 +36,822 @@ namespace
 		uint32_t RootDataCount;
 	};
 
+	//
+	// Memory layout of a structure or sum type, as computed by the
+	// compiler. Only fields that can lead to a string are listed. A
+	// sum type has a single field with type ID 0, giving the offset
+	// of the payload; the tag is always at offset 0.
+	//
+	struct GCTypeLayout
+	{
+		uint32_t TypeID;
+		uint32_t Size;
+		uint32_t FieldIndex;
+		uint32_t FieldCount;
+	};
+
+	struct GCFieldData
+	{
+		uint32_t Offset;
+		uint32_t TypeID;
+	};
+
 	struct GCImageTable
 	{
 		unsigned NumEntries;
+		unsigned NumRoots;
+		unsigned NumLayouts;
+		unsigned NumFields;
+
 		const GCSafePointData* Entries;
 		const GCRootData* Roots;
+		const GCTypeLayout* Layouts;
+		const GCFieldData* Fields;
 	};
 
 
 	GCImageTable GCTable;
+	uint64_t ImageBase;
+
+	//
+	// LLVM records a frame size of ~0 for functions with dynamic
+	// allocas or stack realignment; those need a real unwinder.
+	//
+	const uint32_t DynamicFrameSize = 0xffffffff;
+
+
+	const uint32_t StringTypeID = 0x02000000;
+	const uint32_t BufferTypeID = 0x02000001;
+	const uint32_t StringBuilderTypeID = 0x02000002;
+	const uint32_t NothingTypeID = 0x04;
+	const uint32_t ReferenceFlag = 0x80000000;
+
+	//
+	// Buffers and builders are held as plain pointers into the pool,
+	// just like strings, and are visited the same way wherever they
+	// turn up
+	//
+	bool IsPooledTypeID(uint32_t epochtype)
+	{
+		return epochtype == StringTypeID || epochtype == BufferTypeID || epochtype == StringBuilderTypeID;
+	}
+
+	bool IsStructureTypeID(uint32_t epochtype)
+	{
+		uint32_t family = epochtype & 0x7f000000;
+		return family == 0x03000000 || family == 0x08000000;
+	}
+
+	bool IsSumTypeID(uint32_t epochtype)
+	{
+		return (epochtype & 0x7f000000) == 0x07000000;
+	}
+
+
+	//
+	// Every thread that runs Epoch code is registered here along with
+	// its string pool. A thread is "parked" when it is stopped at a
+	// runtime call waiting for a collection, or blocked inside a safe
+	// region; either way its stack cannot change until it resumes, so
+	// ParkedFrame tells the collector where to start walking it.
+	//
+	struct MutatorThread
+	{
+		ThreadStringPool* Pool;
+		uint64_t StackBase;
+		StackFrameCursor ParkedFrame;
+		const char** Pinned[2];
+		bool Parked;
+	};
+
+	std::mutex RegistryMutex;
+	std::condition_variable ThreadParked;
+	std::condition_variable CollectionFinished;
+
+	std::vector<MutatorThread*> Threads;
+
+	// Set while some thread is running a collection. A request can be
+	// pending without a collector, in which case the next thread to
+	// reach a safepoint takes on the job.
+	bool CollectorActive = false;
+
+	//
+	// Pools outlive the threads that own them, since other threads
+	// may still hold strings allocated there. A pool is released by
+	// the first collection that finds it orphaned and empty.
+	//
+	std::vector<ThreadStringPool*> Pools;
+
+	thread_local MutatorThread* CurrentThread = nullptr;
+
+
+	//
+	// A major collection runs once the mature heap has grown by at
+	// least this much, or by its own size after the last major
+	// collection if that is larger. Otherwise we only empty the
+	// nurseries.
+	//
+	// Incremental sweeps deduct what they free as they go, so this
+	// is updated outside the registry lock.
+	//
+	const size_t MinMajorGrowthBytes = 4 * 1024 * 1024;
+	std::atomic<size_t> MatureBytesAfterMajor(0);
+
+
+	//
+	// Collector tuning, read from the environment at startup:
+	//
+	//   EPOCH_GC_INCREMENTAL   if set, major collections only mark during
+	//                          the pause; each thread then sweeps its own
+	//                          pool in slices as it allocates
+	//   EPOCH_GC_SLICE_US      time budget for one sweep slice (default 500)
+	//   EPOCH_GC_SLICE_WORK    work budget for one sweep slice, in blocks
+	//                          examined (default 0, meaning no limit)
+	//   EPOCH_GC_AUTO          set to 0 to collect only when asked to by
+	//                          compiled code
+	//   EPOCH_GC_MIN_BUDGET_KB smallest allocation budget between automatic
+	//                          collections (default 4096)
+	//   EPOCH_GC_GROWTH_PERCENT  allocation budget as a percentage of the
+	//                          live mature heap (default 100)
+	//   EPOCH_GC_COMPACT       if set, major collections also evacuate
+	//                          sparsely occupied chunks; this needs the
+	//                          sweep done, so it overrides incremental
+	//                          sweeping
+	//   EPOCH_GC_COMPACT_OCCUPANCY  chunks less full than this percentage
+	//                          are evacuated (default 50)
+	//   EPOCH_GC_TRIM_PERCENT  when a major collection frees at least this
+	//                          percentage of the mature heap, spare chunks
+	//                          and idle nursery pages are handed back to
+	//                          the OS (default 50; 0 disables)
+	//   EPOCH_GC_PROFILE_KB    if set, sample about one string allocation
+	//                          per this many KB and print the allocation
+	//                          sites at exit (default 0, meaning off)
+	//   EPOCH_GC_DEDUP         if set, collections point every reference
+	//                          to a string at the first string with the
+	//                          same characters that they reached, so the
+	//                          other copies can be freed
+	//   EPOCH_GC_DEDUP_US      time budget for deduplication in one
+	//                          collection (default 1000; 0 for no limit)
+	//   EPOCH_GC_DEDUP_MIN_LENGTH  shorter strings are left alone
+	//                          (default 16)
+	//
+	struct Tuning
+	{
+		bool IncrementalSweep;
+		uint64_t SliceMicroseconds;
+		size_t SliceWork;
+
+		bool AutoCollect;
+		size_t MinBudgetBytes;
+		uint64_t GrowthPercent;
+
+		bool Compact;
+		unsigned CompactOccupancyPercent;
+
+		unsigned TrimPercent;
+
+		size_t ProfileIntervalBytes;
+
+		bool Dedup;
+		uint64_t DedupMicroseconds;
+		size_t DedupMinLength;
+	};
+
+	Tuning Config = { false, 500, 0, true, 4 * 1024 * 1024, 100, false, 50, 50, 0, false, 1000, 16 };
+
+	// Granularity at which a slice checks its time budget
+	const size_t SweepStep = 256;
+
+	uint64_t ReadEnvironmentNumber(const char* name, uint64_t defaultvalue)
+	{
+		const char* value = getenv(name);
+		if(!value || !*value)
+			return defaultvalue;
+
+		return strtoull(value, nullptr, 10);
+	}
+
+
+	//
+	// Bytes handed out by all pools since the last collection, and how
+	// many we let through before asking for the next one. The budget
+	// scales with the live heap so that collection work stays roughly
+	// proportional to allocation work as the program grows.
+	//
+	std::atomic<size_t> AllocatedSinceCollection(0);
+	std::atomic<size_t> AllocationBudget(4 * 1024 * 1024);
+
+	void ResetAllocationBudget()
+	{
+		size_t maturebytes = 0;
+		for(const ThreadStringPool* pool : Pools)
+			maturebytes += pool->GetMatureBytes();
+
+		size_t budget = static_cast<size_t>(maturebytes * Config.GrowthPercent / 100);
+		AllocationBudget.store(std::max(Config.MinBudgetBytes, budget), std::memory_order_relaxed);
+		AllocatedSinceCollection.store(0, std::memory_order_relaxed);
+	}
+
+
+	//
+	// Statistics are written from whichever thread paused, so they
+	// get a lock of their own rather than the registry lock.
+	//
+	// Set EPOCH_GC_TRACE to a file name (or "-" for stderr) to get a
+	// line in that file for every collection and sweep slice.
+	//
+	std::mutex StatsMutex;
+	CollectorStats Stats;
+	uint64_t CollectionCount = 0;
+	FILE* TraceLog = nullptr;
+
+	double GetElapsedMs(std::chrono::steady_clock::time_point start)
+	{
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count();
+	}
+
+	void RecordCollection(const CollectionRecord& record)
+	{
+		std::lock_guard<std::mutex> lock(StatsMutex);
+		Stats.RecordCollection(record);
+		++CollectionCount;
+
+		if(!TraceLog)
+			return;
+
+		fprintf(TraceLog, "gc %llu %s: pause %.3f ms, %llu frames walked, %llu roots, freed %llu entries (%llu bytes), pool %llu -> %llu bytes, moved %llu entries, deduplicated %llu strings (%llu bytes), %llu bytes committed\n",
+			static_cast<unsigned long long>(CollectionCount), record.Major ? "major" : "minor", record.PauseMs,
+			static_cast<unsigned long long>(record.FramesWalked), static_cast<unsigned long long>(record.RootsFound),
+			static_cast<unsigned long long>(record.EntriesFreed), static_cast<unsigned long long>(record.BytesFreed),
+			static_cast<unsigned long long>(record.PoolBytesBefore), static_cast<unsigned long long>(record.PoolBytesAfter),
+			static_cast<unsigned long long>(record.EntriesMoved),
+			static_cast<unsigned long long>(record.DedupStrings), static_cast<unsigned long long>(record.DedupBytesSaved),
+			static_cast<unsigned long long>(record.CommittedBytes));
+		fflush(TraceLog);
+	}
+
+	void RecordSweepSlice(const CollectionRecord& record)
+	{
+		std::lock_guard<std::mutex> lock(StatsMutex);
+		Stats.RecordSweepSlice(record);
+
+		if(!TraceLog)
+			return;
+
+		fprintf(TraceLog, "sweep slice: pause %.3f ms, freed %llu entries (%llu bytes), pool %llu -> %llu bytes\n",
+			record.PauseMs,
+			static_cast<unsigned long long>(record.EntriesFreed), static_cast<unsigned long long>(record.BytesFreed),
+			static_cast<unsigned long long>(record.PoolBytesBefore), static_cast<unsigned long long>(record.PoolBytesAfter));
+		fflush(TraceLog);
+	}
+
+
+	struct AddressRange
+	{
+		const char* Begin;
+		const char* End;
+
+		bool Contains(const char* p) const
+		{
+			return (p >= Begin) && (p < End);
+		}
+	};
+
+	//
+	// Static strings (the @epoch_static_string: literals emitted by
+	// the compiler) live in the program image, and a handful of stub
+	// runtime exports return literals from our own image. Neither has
+	// a pool header, so roots pointing into these ranges are skipped.
+	//
+	AddressRange ProgramImageRange;
+	AddressRange RuntimeImageRange;
+
+
+	// Set while references to evacuated strings are being redirected
+	bool Compacting = false;
+
+	//
+	// Strings handed to native code by GC::Pin. Their chunks can only
+	// be looked up safely while the owning thread is stopped, so the
+	// chunks are marked as immovable at the start of each compaction.
+	// Entries for strings that have since been freed are dropped then.
+	// Deduplication leaves these strings alone, since freeing one of
+	// them would pull it out from under the native code.
+	//
+	std::unordered_set<const char*> PinnedStrings;
+
+	// Weak, so consulted only after marking and compaction
+	InternTable Interned;
+
+
+	//
+	// Deduplication state for the collection in progress. Strings are
+	// keyed by their characters; the first string reached with a given
+	// key is the one later copies are replaced with. A nursery copy is
+	// simply forwarded to it instead of being promoted. Mature copies
+	// are remembered, and count as saved if nothing else marked them.
+	//
+	struct DedupKey
+	{
+		const char* Chars;
+		uint32_t Length;
+		uint32_t Hash;
+
+		bool operator == (const DedupKey& other) const
+		{
+			return Length == other.Length && Hash == other.Hash && memcmp(Chars, other.Chars, Length) == 0;
+		}
+	};
+
+	struct DedupKeyHash
+	{
+		size_t operator () (const DedupKey& key) const
+		{
+			return key.Hash;
+		}
+	};
+
+	std::unordered_map<DedupKey, const char*, DedupKeyHash> DedupCanonical;
+	std::unordered_set<const char*> DedupMatureCopies;
+
+	bool Deduplicating = false;
+	std::chrono::steady_clock::time_point DedupDeadline;
+	size_t DedupLookups = 0;
+	uint64_t DedupYoungCopies = 0;
+	uint64_t DedupYoungBytes = 0;
+
+	// Granularity at which deduplication checks its time budget
+	const size_t DedupStep = 64;
+
+
+	AddressRange GetImageRange(const void* imagebase)
+	{
+		const char* base = reinterpret_cast<const char*>(imagebase);
+		const IMAGE_DOS_HEADER* dosheader = reinterpret_cast<const IMAGE_DOS_HEADER*>(base);
+		const IMAGE_NT_HEADERS* ntheaders = reinterpret_cast<const IMAGE_NT_HEADERS*>(base + dosheader->e_lfanew);
+
+		AddressRange range;
+		range.Begin = base;
+		range.End = base + ntheaders->OptionalHeader.SizeOfImage;
+		return range;
+	}
+
+	bool IsStaticString(const char* p)
+	{
+		return ProgramImageRange.Contains(p) || RuntimeImageRange.Contains(p);
+	}
+
+	uint64_t GetSectionAddress(const void* imagebase, const char* name)
+	{
+		const char* base = reinterpret_cast<const char*>(imagebase);
+		const IMAGE_DOS_HEADER* dosheader = reinterpret_cast<const IMAGE_DOS_HEADER*>(base);
+		const IMAGE_NT_HEADERS* ntheaders = reinterpret_cast<const IMAGE_NT_HEADERS*>(base + dosheader->e_lfanew);
+
+		const IMAGE_SECTION_HEADER* section = IMAGE_FIRST_SECTION(ntheaders);
+		for(unsigned i = 0; i < ntheaders->FileHeader.NumberOfSections; ++i, ++section)
+		{
+			if(strncmp(reinterpret_cast<const char*>(section->Name), name, IMAGE_SIZEOF_SHORT_NAME) == 0)
+				return reinterpret_cast<uint64_t>(base) + section->VirtualAddress;
+		}
+
+		return 0;
+	}
+
+
+	//
+	// Allocation sampling (see EPOCH_GC_PROFILE_KB). Samples are taken
+	// by mutators as they allocate, and brought up to date by the
+	// collector, so the profile has a lock of its own. Symbols are
+	// only loaded once a report is actually wanted.
+	//
+	std::mutex ProfileMutex;
+	AllocationProfile* Profile = nullptr;
+	SymbolTable ProfileSymbols;
+	bool ProfileSymbolsLoaded = false;
+
+	thread_local std::minstd_rand SampleGenerator(std::random_device{}());
+
+	void LoadProfileSymbols()
+	{
+		if(ProfileSymbolsLoaded)
+			return;
+
+		ProfileSymbolsLoaded = true;
+
+		char path[MAX_PATH];
+		DWORD length = ::GetModuleFileNameA(NULL, path, MAX_PATH);
+
+		std::string filename(path, length);
+		filename = filename.substr(0, filename.find_last_of('.')) + ".sym";
+
+		ProfileSymbols.Load(filename, GetSectionAddress(ProgramImageRange.Begin, ".text"));
+	}
+
+	//
+	// Follow the sampled strings through a collection, before the
+	// nurseries are emptied: nursery strings have either been
+	// promoted by now or are garbage, and after a major trace any
+	// mature string left unmarked is garbage.
+	//
+	void UpdateProfileSamples(bool major)
+	{
+		if(!Profile)
+			return;
+
+		std::lock_guard<std::mutex> lock(ProfileMutex);
+		Profile->UpdateSamples([major](const char*& s) {
+			for(const ThreadStringPool* pool : Pools)
+			{
+				if(pool->InNursery(s))
+				{
+					const StringHeader* header = ThreadStringPool::GetHeader(s);
+					if(header->TraceFlag != StringHeader::ForwardedFlag)
+						return AllocationProfile::SampleDead;
+
+					s = header->Forward;
+					return AllocationProfile::SampleLive;
+				}
+			}
+
+			if(!major)
+				return AllocationProfile::SampleNotTraced;
+
+			const StringHeader* header = ThreadStringPool::GetHeader(s);
+			return header->Owner->IsMarked(s) ? AllocationProfile::SampleLive : AllocationProfile::SampleDead;
+		});
+	}
+
+	void RelocateProfileSamples()
+	{
+		if(!Profile)
+			return;
+
+		std::lock_guard<std::mutex> lock(ProfileMutex);
+		Profile->UpdateSamples([](const char*& s) {
+			for(const ThreadStringPool* pool : Pools)
+			{
+				if(pool->IsEvacuating(s))
+				{
+					const StringHeader* header = ThreadStringPool::GetHeader(s);
+					if(header->TraceFlag == StringHeader::ForwardedFlag)
+						s = header->Forward;
+
+					break;
+				}
+			}
+
+			return AllocationProfile::SampleNotTraced;
+		});
+	}
+
+
+	//
+	// Key for a string that deduplication should consider, or a key
+	// with no characters if it should not. Only whole, uninterned
+	// strings are replaced, though interned ones still serve as the
+	// copy others are replaced with. Buffers are written in place and
+	// take no part at all, and neither do mapped files, which would
+	// have every page read in just to be hashed.
+	//
+	DedupKey MakeDedupKey(const char* s, const StringHeader* header)
+	{
+		DedupKey key = { nullptr, 0, 0 };
+		if(!Deduplicating || header->IsSlice || header->IsBuffer || header->IsMapped || header->Length < Config.DedupMinLength)
+			return key;
+
+		if(++DedupLookups % DedupStep == 0 && Config.DedupMicroseconds && std::chrono::steady_clock::now() >= DedupDeadline)
+		{
+			Deduplicating = false;
+			return key;
+		}
+
+		key.Chars = s;
+		key.Length = header->Length;
+		key.Hash = ThreadStringPool::HashChars(s, header->Length);
+		return key;
+	}
+
+	//
+	// The string already reached with the same characters, or null
+	// if this one is the first, in which case it is remembered
+	// under its final address.
+	//
+	const char* FindDuplicate(const DedupKey& key)
+	{
+		if(!key.Chars)
+			return nullptr;
+
+		auto iter = DedupCanonical.find(key);
+		return (iter == DedupCanonical.end()) ? nullptr : iter->second;
+	}
+
+	void RememberOriginal(DedupKey key, const char* s)
+	{
+		if(!key.Chars)
+			return;
+
+		key.Chars = s;
+		DedupCanonical.emplace(key, s);
+	}
+
+	//
+	// A nursery string that has not been promoted yet. If an earlier
+	// string has the same characters, the nursery copy forwards to
+	// that one instead, and is never copied at all.
+	//
+	const char* PromoteOrShare(const char* s)
+	{
+		StringHeader* header = ThreadStringPool::GetHeader(s);
+
+		DedupKey key = MakeDedupKey(s, header);
+		if(const char* original = FindDuplicate(key))
+		{
+			if(!header->IsInterned)
+			{
+				++DedupYoungCopies;
+				DedupYoungBytes += sizeof(StringHeader) + header->Length + 1;
+
+				header->Forward = original;
+				header->TraceFlag = StringHeader::ForwardedFlag;
+				return original;
+			}
+		}
+
+		const char* promoted = header->Owner->Promote(s);
+		RememberOriginal(key, promoted);
+		return promoted;
+	}
+
+	//
+	// A mature string reached by a major collection, or the earlier
+	// string with the same characters that should be used instead
+	//
+	const char* ShareMature(const char* s)
+	{
+		const StringHeader* header = ThreadStringPool::FindHeader(s);
+		if(!header || PinnedStrings.count(s))
+			return s;
+
+		DedupKey key = MakeDedupKey(s, header);
+		const char* original = FindDuplicate(key);
+		if(!original)
+		{
+			RememberOriginal(key, s);
+			return s;
+		}
+
+		if(original == s || header->IsInterned)
+			return s;
+
+		DedupMatureCopies.insert(s);
+		return original;
+	}
+
+	void BeginDeduplication()
+	{
+		Deduplicating = Config.Dedup;
+		DedupDeadline = std::chrono::steady_clock::now() + std::chrono::microseconds(Config.DedupMicroseconds);
+		DedupLookups = 0;
+		DedupYoungCopies = 0;
+		DedupYoungBytes = 0;
+	}
+
+	//
+	// Once marking is over, mature copies that were replaced
+	// everywhere they were found are left unmarked, and the sweep
+	// frees them. Any still marked were also reached some other way
+	// (after the time budget ran out, say) and are not counted.
+	//
+	void FinishDeduplication(bool major, CollectionRecord& record)
+	{
+		record.DedupStrings = DedupYoungCopies;
+		record.DedupBytesSaved = DedupYoungBytes;
+
+		if(major)
+		{
+			for(const char* s : DedupMatureCopies)
+			{
+				const StringHeader* header = ThreadStringPool::GetHeader(s);
+				if(!header->Owner->IsMarked(s))
+				{
+					++record.DedupStrings;
+					record.DedupBytesSaved += sizeof(StringHeader) + header->Length + 1;
+				}
+			}
+		}
+
+		Deduplicating = false;
+		DedupCanonical.clear();
+		DedupMatureCopies.clear();
+	}
+
+
+	//
+	// Visit one reference to a string. A string still sitting in a
+	// nursery is promoted (into its owner's mature heap) and the
+	// reference updated to point at the copy; a major collection
+	// then marks whatever the reference ends up pointing to. During
+	// compaction, references to evacuated strings are redirected to
+	// their new copies in the same way.
+	//
+	// A slice is followed through to its base, which is treated as
+	// one more reference. Bases are never slices, so this goes only
+	// one level deep.
+	//
+	// While deduplication is on, the reference may instead be pointed
+	// at another string with the same characters.
+	//
+	bool VisitRoot(const char** slot, bool major)
+	{
+		const char* str = *slot;
+		if(!str || IsStaticString(str))
+			return false;
+
+		bool young = false;
+		for(ThreadStringPool* pool : Pools)
+		{
+			if(pool->InNursery(str))
+			{
+				young = true;
+
+				const StringHeader* header = ThreadStringPool::GetHeader(str);
+				if(header->TraceFlag == StringHeader::ForwardedFlag)
+					str = header->Forward;
+				else
+					str = PromoteOrShare(str);
+
+				*slot = str;
+				break;
+			}
+
+			if(Compacting && pool->IsEvacuating(str))
+			{
+				// Stale slots may still point at blocks freed by the sweep
+				const StringHeader* header = ThreadStringPool::GetHeader(str);
+				if(header->TraceFlag == StringHeader::ForwardedFlag)
+				{
+					str = header->Forward;
+					*slot = str;
+				}
+
+				break;
+			}
+		}
+
+		if(major)
+		{
+			if(Deduplicating && !young)
+			{
+				str = ShareMature(str);
+				*slot = str;
+			}
+
+			for(ThreadStringPool* pool : Pools)
+			{
+				if(pool->MarkInUse(str))
+					break;
+			}
+		}
+
+		if(SliceData* slice = ThreadStringPool::FindSlice(str))
+			VisitRoot(&slice->Base, major);
+
+		return true;
+	}
+
+
+	//
+	// Layouts are sorted by type ID, like safepoints by address.
+	//
+	const GCTypeLayout* FindTypeLayout(uint32_t epochtype)
+	{
+		const GCTypeLayout* begin = GCTable.Layouts;
+		const GCTypeLayout* end = GCTable.Layouts + GCTable.NumLayouts;
+
+		const GCTypeLayout* iter = std::lower_bound(begin, end, epochtype, [](const GCTypeLayout& layout, uint32_t id) {
+			return layout.TypeID < id;
+		});
+
+		if(iter == end || iter->TypeID != epochtype)
+			return nullptr;
+
+		return iter;
+	}
+
+
+	//
+	// Objects reached through a pointer (a reference, or the payload
+	// of a sum type) may live on the stack as well as in the heap, and
+	// may point back at each other. Each one is traced once per
+	// collection; the type is part of the key because a structure and
+	// its first member share an address.
+	//
+	struct TracedObject
+	{
+		const void* Address;
+		uint32_t TypeID;
+
+		bool operator == (const TracedObject& rhs) const
+		{
+			return Address == rhs.Address && TypeID == rhs.TypeID;
+		}
+	};
+
+	struct TracedObjectHash
+	{
+		size_t operator () (const TracedObject& object) const
+		{
+			return std::hash<const void*>()(object.Address) ^ object.TypeID;
+		}
+	};
+
+	std::unordered_set<TracedObject, TracedObjectHash> TracedObjects;
+	std::vector<TracedObject> TraceQueue;
+
+
+	void QueueObject(void* object, uint32_t epochtype, bool major)
+	{
+		epochtype &= ~ReferenceFlag;
+
+		if(!object)
+			return;
+
+		// A reference to a string, or a sum type holding one, points
+		// at the variable or member with the char* in it
+		if(IsPooledTypeID(epochtype))
+		{
+			VisitRoot(static_cast<const char**>(object), major);
+			return;
+		}
+
+		if(!IsStructureTypeID(epochtype) && !IsSumTypeID(epochtype))
+			return;
+
+		if(!TracedObjects.insert(TracedObject{ object, epochtype }).second)
+			return;
+
+		if(major)
+		{
+			for(ThreadStringPool* pool : Pools)
+			{
+				if(pool->MarkStructure(object))
+					break;
+			}
+		}
+
+		TraceQueue.push_back(TracedObject{ object, epochtype });
+	}
+
+	//
+	// Visit the fields of one object. Structures and sum types held by
+	// value are part of the object and are traced in place; anything
+	// reached through a pointer is queued.
+	//
+	void TraceFields(char* object, uint32_t epochtype, bool major)
+	{
+		const GCTypeLayout* layout = FindTypeLayout(epochtype);
+		if(!layout)
+			return;
+
+		for(uint32_t i = 0; i < layout->FieldCount; ++i)
+		{
+			const GCFieldData& field = GCTable.Fields[i + layout->FieldIndex];
+			char* member = object + field.Offset;
+
+			if(IsSumTypeID(epochtype))
+			{
+				uint32_t tag = *reinterpret_cast<const uint32_t*>(object);
+				if(tag != NothingTypeID)
+					QueueObject(*reinterpret_cast<void**>(member), tag, major);
+			}
+			else if(IsPooledTypeID(field.TypeID))
+				VisitRoot(reinterpret_cast<const char**>(member), major);
+			else if(field.TypeID & ReferenceFlag)
+				QueueObject(*reinterpret_cast<void**>(member), field.TypeID, major);
+			else
+				TraceFields(member, field.TypeID, major);
+		}
+	}
+
+	void DrainTraceQueue(bool major)
+	{
+		while(!TraceQueue.empty())
+		{
+			TracedObject object = TraceQueue.back();
+			TraceQueue.pop_back();
+
+			TraceFields(static_cast<char*>(const_cast<void*>(object.Address)), object.TypeID, major);
+		}
+	}
 
 
-	void WalkStackRoots(uint64_t stackptr, uint32_t framesize, uint32_t rootindex, uint32_t rootcount, ThreadStringPool* stringpool)
+	//
+	// String roots hold the string itself. Any other root holds the
+	// address of a structure or sum type, which is traced through its
+	// layout.
+	//
+	void WalkStackRoots(uint64_t stackptr, uint32_t framesize, uint32_t rootindex, uint32_t rootcount, bool major, CollectionRecord& record)
 	{
 		for(uint32_t i = 0; i < rootcount; ++i)
 		{
@@ -44,76 +860,448 @@ namespace
 			int offset = root.StackFrameOffset;
 			uint32_t type = root.TypeID;
 
-			// TODO - stash structure data, walk heap for references
+			if(type == StringTypeID)
+			{
+				if(VisitRoot(reinterpret_cast<const char**>(stackptr + offset), major))
+					++record.RootsFound;
+			}
+			else
+			{
+				void* object = *reinterpret_cast<void**>(stackptr + offset);
+				if(object)
+				{
+					QueueObject(object, type, major);
+					DrainTraceQueue(major);
+					++record.RootsFound;
+				}
+			}
+		}
+	}
+
+	//
+	// Safepoint records are sorted by return address when the compiler
+	// emits the GC section, so the record for a frame (if any) can be
+	// found by binary search. This keeps the per-frame cost of a stack
+	// walk independent of the total number of safepoints in the program.
+	//
+	const GCSafePointData* FindSafePoint(uint32_t returnip)
+	{
+		const GCSafePointData* begin = GCTable.Entries;
+		const GCSafePointData* end = GCTable.Entries + GCTable.NumEntries;
+
+		const GCSafePointData* iter = std::lower_bound(begin, end, returnip, [](const GCSafePointData& entry, uint32_t ip) {
+			return entry.ReturnIP < ip;
+		});
+
+		if(iter == end || iter->ReturnIP != returnip)
+			return nullptr;
+
+		return iter;
+	}
+
+	//
+	// Walk outwards from the Epoch frame that called into the runtime
+	// until we pass the thread's stack base (for the main thread, the
+	// frame that called ERT_gc_init). Epoch frames with a fixed size
+	// are stepped over using the size recorded in the GC section: the
+	// return address sits just above the frame, and the caller's stack
+	// pointer just above that. Anything else is left to the platform
+	// unwinder.
+	//
+	void StackCrawl(const StackFrameCursor& start, uint64_t stackbase, bool major, CollectionRecord& record)
+	{
+		StackFrameCursor cursor = start;
+
+		while(cursor.InstructionPtr && cursor.StackPtr <= stackbase)
+		{
+			++record.FramesWalked;
+
+			const GCSafePointData* safepointdata = nullptr;
+
+			uint64_t instructionoffset = cursor.InstructionPtr - ImageBase;
+			if(instructionoffset <= 0xffffffff)
+				safepointdata = FindSafePoint(static_cast<uint32_t>(instructionoffset));
+
+			if(safepointdata)
+				WalkStackRoots(cursor.StackPtr, safepointdata->StackFrameSize, safepointdata->RootDataIndex, safepointdata->RootDataCount, major, record);
+
+			if(safepointdata && safepointdata->StackFrameSize != DynamicFrameSize)
+			{
+				const uint64_t* returnslot = reinterpret_cast<const uint64_t*>(cursor.StackPtr + safepointdata->StackFrameSize);
+
+				cursor.InstructionPtr = *returnslot;
+				cursor.StackPtr = reinterpret_cast<uint64_t>(returnslot + 1);
+			}
+			else if(!StackWalk::UnwindForeignFrame(&cursor))
+				break;
+		}
+	}
+
+	size_t GetPoolBytes()
+	{
+		size_t bytes = 0;
+		for(const ThreadStringPool* pool : Pools)
+			bytes += pool->GetMatureBytes() + pool->GetNurseryBytes();
+
+		return bytes;
+	}
+
+	bool ShouldCollectMajor()
+	{
+		size_t maturebytes = 0;
+		for(const ThreadStringPool* pool : Pools)
+			maturebytes += pool->GetMatureBytes();
+
+		size_t baseline = MatureBytesAfterMajor.load(std::memory_order_relaxed);
+		size_t growth = (maturebytes > baseline) ? (maturebytes - baseline) : 0;
+		return growth >= std::max(MinMajorGrowthBytes, baseline);
+	}
+
+	//
+	// Visit every root: the stacks of all registered threads, the
+	// strings pinned by parked runtime calls, the storage of open
+	// string builders still in use, and (for a minor collection)
+	// everything held by structures in the heap.
+	//
+	void TraceRoots(bool major, CollectionRecord& record)
+	{
+		for(MutatorThread* thread : Threads)
+		{
+			StackCrawl(thread->ParkedFrame, thread->StackBase, major, record);
+
+			for(const char** pinned : thread->Pinned)
+			{
+				if(pinned && VisitRoot(pinned, major))
+					++record.RootsFound;
+			}
+		}
+
+		// Builders are reached like buffers, so by now a major collection
+		// has marked every one still held somewhere; the storage of the
+		// rest is left for the sweep. A minor collection cannot tell, and
+		// keeps it all.
+		if(major)
+		{
+			for(ThreadStringPool* pool : Pools)
+				pool->CloseUnreachableBuilders();
+		}
+
+		// A builder writes into its storage, so it must keep a copy of
+		// its own and may not become the copy others share either
+		bool deduplicating = Deduplicating;
+		Deduplicating = false;
+
+		for(ThreadStringPool* pool : Pools)
+		{
+			pool->ForEachBuilderStorage([major, &record](const char** storage) {
+				if(VisitRoot(storage, major))
+					++record.RootsFound;
+			});
+		}
+
+		Deduplicating = deduplicating;
 
-			if(type == 0x02000000)
+		// There is no write barrier on structures, so a minor collection
+		// cannot tell which heap structures were given nursery strings
+		// since the last one; it treats them all as roots instead
+		if(!major)
+		{
+			for(ThreadStringPool* pool : Pools)
 			{
-				// Temp Proof of Concept hack
-				const char** foo = (const char**)((const char*)(stackptr + offset));
-				stringpool->MarkInUse(*foo);
+				pool->ForEachStructure([](void* object, uint32_t epochtype) {
+					TraceFields(static_cast<char*>(object), epochtype, false);
+				});
 			}
+
+			DrainTraceQueue(false);
+		}
+
+		TracedObjects.clear();
+	}
+
+	//
+	// Pin exactly the chunks that hold live pinned strings. Pins are
+	// recomputed from scratch each time, so a chunk whose pinned
+	// strings have all died can be evacuated again.
+	//
+	void UpdatePinnedStrings()
+	{
+		for(ThreadStringPool* pool : Pools)
+			pool->ClearPins();
+
+		for(auto iter = PinnedStrings.begin(); iter != PinnedStrings.end(); )
+		{
+			bool live = std::any_of(Pools.begin(), Pools.end(), [iter](ThreadStringPool* pool) {
+				return pool->Pin(*iter);
+			});
+
+			if(live)
+				++iter;
+			else
+				iter = PinnedStrings.erase(iter);
 		}
 	}
 
-	void TraceStackRoots(uint64_t instructionptr, uint64_t stackptr, ThreadStringPool* stringpool)
+	//
+	// Move the survivors out of sparsely occupied chunks so that those
+	// chunks can be given back to the OS. Every reference is then
+	// redirected by a second pass over the roots, made in minor mode
+	// so that nothing is marked again; the nurseries are empty by now,
+	// so the only thing the pass changes is evacuated strings.
+	//
+	void CompactPools(CollectionRecord& record)
 	{
-		uint64_t baseaddr = reinterpret_cast<uint64_t>(::GetModuleHandle(NULL));
-		uint64_t instructionoffset = instructionptr - baseaddr;
+		UpdatePinnedStrings();
 
-		const GCSafePointData* safepointdata = GCTable.Entries;
+		size_t moved = 0;
+		for(ThreadStringPool* pool : Pools)
+			moved += pool->EvacuateSparseChunks(Config.CompactOccupancyPercent);
 
-		for(unsigned i = 0; i < GCTable.NumEntries; ++i, ++safepointdata)
+		if(moved)
 		{
-			if(instructionoffset != safepointdata->ReturnIP)
-				continue;
+			CollectionRecord fixup = CollectionRecord();
 
-			WalkStackRoots(stackptr, safepointdata->StackFrameSize, safepointdata->RootDataIndex, safepointdata->RootDataCount, stringpool);
+			Compacting = true;
+			TraceRoots(false, fixup);
+			Interned.ForEachEntry([](const char*& s) {
+				VisitRoot(&s, false);
+			});
+			Compacting = false;
+
+			RelocateProfileSamples();
 		}
+
+		for(ThreadStringPool* pool : Pools)
+			record.ChunksReleased += pool->ReleaseEvacuatedChunks();
+
+		record.EntriesMoved = moved;
 	}
 
-	void StackCrawl(ThreadStringPool* stringpool)
+	//
+	// After a collection that emptied out much of the heap, the memory
+	// each pool keeps in reserve is out of proportion to what is left
+	// live, so give it back.
+	//
+	void TrimPools(size_t maturebefore, size_t matureafter, CollectionRecord& record)
 	{
-		CONTEXT ctx;
-		memset(&ctx, 0, sizeof(ctx));
-		ctx.ContextFlags = CONTEXT_FULL;
-		RtlCaptureContext(&ctx);
+		if(!Config.TrimPercent || maturebefore <= matureafter)
+			return;
+
+		if((maturebefore - matureafter) * 100 < maturebefore * Config.TrimPercent)
+			return;
 
-		STACKFRAME64 frame;
-		memset(&frame, 0, sizeof(frame));
+		for(ThreadStringPool* pool : Pools)
+			record.ChunksReleased += pool->Trim();
+	}
 
-		frame.AddrPC.Offset = ctx.Rip;
-		frame.AddrPC.Mode = AddrModeFlat;
+	size_t GetCommittedBytes()
+	{
+		size_t bytes = 0;
+		for(const ThreadStringPool* pool : Pools)
+			bytes += pool->GetCommittedBytes();
 
-		frame.AddrFrame.Offset = ctx.Rbp;
-		frame.AddrFrame.Mode = AddrModeFlat;
+		return bytes;
+	}
 
-		frame.AddrStack.Offset = ctx.Rsp;
-		frame.AddrStack.Mode = AddrModeFlat;
+	//
+	// Trace from every registered thread's stack, promoting nursery
+	// survivors as we go, and then empty the nurseries. A major
+	// collection also sweeps the mature heap of every pool, and may
+	// compact it. All threads must be parked, and the registry lock
+	// held.
+	//
+	void TraceAndSweep(bool major, CollectionRecord& record)
+	{
+		record.Major = major;
+		record.PoolBytesBefore = GetPoolBytes();
 
-		unsigned skip = 2;
-		unsigned hack = 0;
+		size_t freedentries = 0;
 
-		while(::StackWalk64(IMAGE_FILE_MACHINE_AMD64, ::GetCurrentProcess(), ::GetCurrentThread(), &frame, &ctx, NULL, NULL, NULL, NULL))
+		if(major)
 		{
-			if(!frame.AddrPC.Offset)
-				break;
+			// Anything left over from an incremental sweep has to go
+			// before the trace flags flip, or it would look marked
+			for(ThreadStringPool* pool : Pools)
+			{
+				if(pool->IsSweeping())
+					pool->SweepSome(~size_t(0), freedentries);
+
+				pool->ToggleTraceBit();
+			}
+		}
+
+		BeginDeduplication();
+		TraceRoots(major, record);
+		FinishDeduplication(major, record);
+
+		UpdateProfileSamples(major);
+
+		// Interned strings nobody else reached are about to be swept
+		if(major)
+		{
+			record.InternedDropped = Interned.RemoveIf([](const char* s) {
+				return !ThreadStringPool::GetHeader(s)->Owner->IsMarked(s);
+			});
+
+			// Likewise for pinned strings. This has to happen before
+			// the sweep, or a new string in a freed slot would inherit
+			// the pin of the dead one.
+			for(auto iter = PinnedStrings.begin(); iter != PinnedStrings.end(); )
+			{
+				const StringHeader* header = ThreadStringPool::FindHeader(*iter);
+				if(header && header->Owner && header->Owner->IsMarked(*iter))
+					++iter;
+				else
+					iter = PinnedStrings.erase(iter);
+			}
+		}
+
+		Interned.ReleaseRetiredTables();
+		record.InternedStrings = Interned.GetCount();
+
+		for(ThreadStringPool* pool : Pools)
+			pool->ResetNursery();
+
+		if(major)
+		{
+			size_t maturebefore = 0;
+			for(const ThreadStringPool* pool : Pools)
+				maturebefore += pool->GetMatureBytes();
 
-			if(skip > 0)
+			size_t maturebytes = 0;
+			for(ThreadStringPool* pool : Pools)
 			{
-				--skip;
-				continue;
+				freedentries += pool->FreeUnusedStructures();
+				freedentries += pool->FreeUnusedBuffers();
+				freedentries += pool->FreeUnusedLargeObjects();
+				freedentries += pool->FreeUnusedMappedFiles();
+
+				bool owned = std::any_of(Threads.begin(), Threads.end(), [pool](const MutatorThread* thread) {
+					return thread->Pool == pool;
+				});
+
+				// Orphaned pools have nobody to sweep them later
+				if(Config.IncrementalSweep && !Config.Compact && owned)
+					pool->BeginSweep();
+				else
+					freedentries += pool->FreeUnusedEntries();
+
+				maturebytes += pool->GetMatureBytes();
 			}
 
-			char buffer[1024] = {0};
-			SYMBOL_INFO* syminfo = (SYMBOL_INFO*)(buffer);
-			syminfo->SizeOfStruct = sizeof(SYMBOL_INFO);
-			syminfo->MaxNameLen = 256;
+			MatureBytesAfterMajor.store(maturebytes, std::memory_order_relaxed);
 
+			if(Config.Compact)
+				CompactPools(record);
+			else if(Config.Dedup)
+				UpdatePinnedStrings();
 
-			DWORD64 displ = 0;
-			BOOL success = ::SymFromAddr(::GetCurrentProcess(), frame.AddrPC.Offset, &displ, syminfo);
+			TrimPools(maturebefore, maturebytes, record);
+		}
+
+		Pools.erase(std::remove_if(Pools.begin(), Pools.end(), [](ThreadStringPool* pool) {
+			bool owned = std::any_of(Threads.begin(), Threads.end(), [pool](const MutatorThread* thread) {
+				return thread->Pool == pool;
+			});
+
+			if(owned || !pool->IsEmpty())
+				return false;
+
+			delete pool;
+			return true;
+		}), Pools.end());
+
+		// Promoted survivors count towards the pool after, so for a
+		// minor collection this is just the nursery garbage
+		record.PoolBytesAfter = GetPoolBytes();
+		record.EntriesFreed = freedentries;
+		record.BytesFreed = (record.PoolBytesBefore > record.PoolBytesAfter) ? (record.PoolBytesBefore - record.PoolBytesAfter) : 0;
+		record.CommittedBytes = GetCommittedBytes();
+	}
+
+	//
+	// There is no way to stop a thread that is neither at a runtime
+	// call nor in a safe region, so a collection waits for as long as
+	// any thread keeps away. Compiled code polls at every call into
+	// the runtime, and calls externals tagged blocking from a safe
+	// region, but a loop that does neither (plain arithmetic, say), or
+	// any other native call that blocks, holds up every other thread's
+	// allocations until it finishes.
+	//
+	bool AllThreadsParked()
+	{
+		return std::all_of(Threads.begin(), Threads.end(), [](const MutatorThread* thread) {
+			return thread->Parked;
+		});
+	}
+
+	void ParkLocked(std::unique_lock<std::mutex>& lock, MutatorThread* self, const StackFrameCursor& callerframe, const char** pin0, const char** pin1)
+	{
+		self->ParkedFrame = callerframe;
+		self->Pinned[0] = pin0;
+		self->Pinned[1] = pin1;
+		self->Parked = true;
+		ThreadParked.notify_all();
+
+		CollectionFinished.wait(lock, [] {
+			return !CollectorActive;
+		});
+
+		self->Parked = false;
+		self->Pinned[0] = nullptr;
+		self->Pinned[1] = nullptr;
+	}
+
+	//
+	// Stop the world from the calling thread, which parks at the given
+	// frame like everybody else while it does the collecting.
+	//
+	void CollectLocked(std::unique_lock<std::mutex>& lock, MutatorThread* self, const StackFrameCursor& callerframe, const char** pin0, const char** pin1)
+	{
+		auto start = std::chrono::steady_clock::now();
 
-			TraceStackRoots(frame.AddrPC.Offset, frame.AddrStack.Offset, stringpool);
+		CollectorActive = true;
+		GC::CollectionRequested.store(true, std::memory_order_release);
+
+		self->ParkedFrame = callerframe;
+		self->Pinned[0] = pin0;
+		self->Pinned[1] = pin1;
+		self->Parked = true;
+
+		ThreadParked.wait(lock, AllThreadsParked);
+
+		CollectionRecord record = CollectionRecord();
+		TraceAndSweep(ShouldCollectMajor(), record);
+		ResetAllocationBudget();
+
+		self->Parked = false;
+		self->Pinned[0] = nullptr;
+		self->Pinned[1] = nullptr;
+
+		CollectorActive = false;
+		GC::CollectionRequested.store(false, std::memory_order_release);
+		CollectionFinished.notify_all();
+
+		record.PauseMs = GetElapsedMs(start);
+		RecordCollection(record);
+	}
+
+	//
+	// Respond to a pending request at a safepoint: take part in the
+	// collection already under way, or run it ourselves if nobody has
+	// picked it up yet.
+	//
+	void ServiceRequestLocked(std::unique_lock<std::mutex>& lock, MutatorThread* self, const StackFrameCursor& callerframe, const char** pin0, const char** pin1)
+	{
+		while(GC::CollectionRequested.load(std::memory_order_relaxed))
+		{
+			if(!CollectorActive)
+			{
+				CollectLocked(lock, self, callerframe, pin0, pin1);
+				return;
+			}
+
+			ParkLocked(lock, self, callerframe, pin0, pin1);
 		}
 	}
 
@@ -121,27 +1309,408 @@ namespace
 }
 
 
+std::atomic<bool> GC::CollectionRequested(false);
+
 
-void GC::Init(uint32_t gcsectionoffset)
+
+void GC::Init(uint32_t gcsectionoffset, const StackFrameCursor& entryframe)
 {
 	const char* baseofprocess = reinterpret_cast<const char*>(::GetModuleHandle(NULL));
 	const char* gcsection = baseofprocess + gcsectionoffset;
 
-	GCTable.NumEntries = *reinterpret_cast<const unsigned*>(gcsection);
-	GCTable.Entries = reinterpret_cast<const GCSafePointData*>(gcsection + sizeof(unsigned));
-	GCTable.Roots = reinterpret_cast<const GCRootData*>(reinterpret_cast<const char*>(GCTable.Entries) + GCTable.NumEntries * sizeof(GCSafePointData));
+	ImageBase = reinterpret_cast<uint64_t>(baseofprocess);
+
+	const unsigned* counts = reinterpret_cast<const unsigned*>(gcsection);
+	GCTable.NumEntries = counts[0];
+	GCTable.NumRoots = counts[1];
+	GCTable.NumLayouts = counts[2];
+	GCTable.NumFields = counts[3];
 
+	GCTable.Entries = reinterpret_cast<const GCSafePointData*>(counts + 4);
+	GCTable.Roots = reinterpret_cast<const GCRootData*>(GCTable.Entries + GCTable.NumEntries);
+	GCTable.Layouts = reinterpret_cast<const GCTypeLayout*>(GCTable.Roots + GCTable.NumRoots);
+	GCTable.Fields = reinterpret_cast<const GCFieldData*>(GCTable.Layouts + GCTable.NumLayouts);
 
-	::SymSetOptions(::SymGetOptions() | SYMOPT_DEBUG);
-	::SymInitialize(::GetCurrentProcess(), NULL, TRUE);
+	ProgramImageRange = GetImageRange(baseofprocess);
+	RuntimeImageRange = GetImageRange(&__ImageBase);
+
+	Config.IncrementalSweep = getenv("EPOCH_GC_INCREMENTAL") != nullptr;
+	Config.SliceMicroseconds = ReadEnvironmentNumber("EPOCH_GC_SLICE_US", Config.SliceMicroseconds);
+	Config.SliceWork = static_cast<size_t>(ReadEnvironmentNumber("EPOCH_GC_SLICE_WORK", Config.SliceWork));
+	Config.AutoCollect = ReadEnvironmentNumber("EPOCH_GC_AUTO", 1) != 0;
+	Config.MinBudgetBytes = static_cast<size_t>(ReadEnvironmentNumber("EPOCH_GC_MIN_BUDGET_KB", Config.MinBudgetBytes / 1024) * 1024);
+	Config.GrowthPercent = ReadEnvironmentNumber("EPOCH_GC_GROWTH_PERCENT", Config.GrowthPercent);
+	Config.Compact = getenv("EPOCH_GC_COMPACT") != nullptr;
+	Config.CompactOccupancyPercent = static_cast<unsigned>(ReadEnvironmentNumber("EPOCH_GC_COMPACT_OCCUPANCY", Config.CompactOccupancyPercent));
+	Config.TrimPercent = static_cast<unsigned>(ReadEnvironmentNumber("EPOCH_GC_TRIM_PERCENT", Config.TrimPercent));
+	Config.ProfileIntervalBytes = static_cast<size_t>(ReadEnvironmentNumber("EPOCH_GC_PROFILE_KB", 0) * 1024);
+	Config.Dedup = getenv("EPOCH_GC_DEDUP") != nullptr;
+	Config.DedupMicroseconds = ReadEnvironmentNumber("EPOCH_GC_DEDUP_US", Config.DedupMicroseconds);
+	Config.DedupMinLength = static_cast<size_t>(ReadEnvironmentNumber("EPOCH_GC_DEDUP_MIN_LENGTH", Config.DedupMinLength));
+
+	if(Config.ProfileIntervalBytes)
+		Profile = new AllocationProfile(Config.ProfileIntervalBytes);
+
+	AllocationBudget.store(Config.MinBudgetBytes, std::memory_order_relaxed);
+
+	const char* tracefile = getenv("EPOCH_GC_TRACE");
+	if(tracefile && *tracefile)
+		TraceLog = (strcmp(tracefile, "-") == 0) ? stderr : fopen(tracefile, "w");
+
+	AttachThread(entryframe.StackPtr);
+}
+
+
+//
+// Register the calling thread as a mutator. The stack base bounds
+// the stack walk; threads that allocate without being attached get
+// an unbounded walk that ends wherever the unwinder gives up.
+//
+void GC::AttachThread(uint64_t stackbase)
+{
+	if(CurrentThread)
+	{
+		CurrentThread->StackBase = stackbase;
+		return;
+	}
+
+	// A new thread cannot be in the middle of the stack being walked,
+	// so it may join even while a collection is running; it only has
+	// to park at its first safepoint like everyone else.
+	std::unique_lock<std::mutex> lock(RegistryMutex);
+
+	MutatorThread* thread = new MutatorThread;
+	thread->Pool = new ThreadStringPool;
+	thread->StackBase = stackbase;
+	thread->ParkedFrame = StackFrameCursor();
+	thread->Pinned[0] = nullptr;
+	thread->Pinned[1] = nullptr;
+	thread->Parked = false;
+
+	Threads.push_back(thread);
+	Pools.push_back(thread->Pool);
+
+	CurrentThread = thread;
+}
+
+void GC::DetachThread()
+{
+	MutatorThread* self = CurrentThread;
+	if(!self)
+		return;
+
+	std::unique_lock<std::mutex> lock(RegistryMutex);
+	Threads.erase(std::remove(Threads.begin(), Threads.end(), self), Threads.end());
+	ThreadParked.notify_all();
+
+	delete self;
+	CurrentThread = nullptr;
+}
+
+
+ThreadStringPool& GC::GetThreadPool()
+{
+	if(!CurrentThread)
+		AttachThread(~uint64_t(0));
+
+	return *CurrentThread->Pool;
+}
+
+
+
+//
+// Stop the world and collect. If another thread is already running
+// a collection, we simply take part in that one instead.
+//
+void GC::CollectStrings(const StackFrameCursor& callerframe)
+{
+	GetThreadPool();
+	MutatorThread* self = CurrentThread;
+
+	std::unique_lock<std::mutex> lock(RegistryMutex);
+	if(CollectorActive)
+	{
+		ParkLocked(lock, self, callerframe, nullptr, nullptr);
+		return;
+	}
+
+	CollectLocked(lock, self, callerframe, nullptr, nullptr);
+}
+
+
+//
+// Ask for a collection without waiting for it. This is safe to call
+// from deep inside an allocation, where the caller's roots cannot be
+// found; the work happens at the next safepoint any thread reaches.
+//
+void GC::RequestCollection()
+{
+	if(!Config.AutoCollect || CollectionRequested.load(std::memory_order_relaxed))
+		return;
+
+	CollectionRequested.store(true, std::memory_order_release);
+}
+
+//
+// Pools batch up their allocation counts before reporting them, so
+// the shared counter is only touched every so often.
+//
+void GC::ReportAllocation(size_t bytes)
+{
+	size_t total = AllocatedSinceCollection.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+	if(total >= AllocationBudget.load(std::memory_order_relaxed))
+		RequestCollection();
+}
+
+
+//
+// Run one bounded slice of a pending incremental sweep. Only the
+// thread that owns the pool may call this, since sweeping touches
+// the same free lists as allocation.
+//
+void GC::SweepSlice(ThreadStringPool* pool)
+{
+	auto start = std::chrono::steady_clock::now();
+	auto deadline = start + std::chrono::microseconds(Config.SliceMicroseconds);
+
+	CollectionRecord record = CollectionRecord();
+	record.PoolBytesBefore = pool->GetMatureBytes();
+
+	size_t freedentries = 0;
+
+	size_t workleft = Config.SliceWork ? Config.SliceWork : ~size_t(0);
+	while(workleft)
+	{
+		size_t step = std::min(workleft, SweepStep);
+		workleft -= step;
+
+		if(pool->SweepSome(step, freedentries))
+			break;
+
+		if(Config.SliceMicroseconds && std::chrono::steady_clock::now() >= deadline)
+			break;
+	}
+
+	record.PoolBytesAfter = pool->GetMatureBytes();
+	record.EntriesFreed = freedentries;
+	record.BytesFreed = record.PoolBytesBefore - record.PoolBytesAfter;
+
+	MatureBytesAfterMajor.fetch_sub(record.BytesFreed, std::memory_order_relaxed);
+
+	record.PauseMs = GetElapsedMs(start);
+	RecordSweepSlice(record);
 }
 
+void GC::Park(const StackFrameCursor& callerframe, const char** pin0, const char** pin1)
+{
+	MutatorThread* self = CurrentThread;
+	if(!self)
+		return;
+
+	std::unique_lock<std::mutex> lock(RegistryMutex);
+	ServiceRequestLocked(lock, self, callerframe, pin0, pin1);
+}
 
 
-void GC::CollectStrings(ThreadStringPool* pool, void* retaddr)
+//
+// Safe regions bracket calls that may block for a long time. The
+// thread counts as parked for the duration, so a collection can go
+// ahead without it, but it may not leave the region until any such
+// collection has finished.
+//
+void GC::EnterSafeRegion(const StackFrameCursor& callerframe)
 {
-	pool->ToggleTraceBit();
-	StackCrawl(pool);
-	pool->FreeUnusedEntries();
+	MutatorThread* self = CurrentThread;
+	if(!self)
+		return;
+
+	// Deal with any request nobody has picked up yet, rather than
+	// leaving it pending for as long as we are blocked
+	std::unique_lock<std::mutex> lock(RegistryMutex);
+	ServiceRequestLocked(lock, self, callerframe, nullptr, nullptr);
+
+	self->ParkedFrame = callerframe;
+	self->Parked = true;
+	ThreadParked.notify_all();
 }
 
+void GC::LeaveSafeRegion()
+{
+	MutatorThread* self = CurrentThread;
+	if(!self)
+		return;
+
+	// Our stack has not changed since we entered the region, so if a
+	// request is still waiting for a collector we can run it from the
+	// frame we parked at.
+	std::unique_lock<std::mutex> lock(RegistryMutex);
+	while(CollectionRequested.load(std::memory_order_relaxed))
+	{
+		if(!CollectorActive)
+		{
+			StackFrameCursor parkedframe = self->ParkedFrame;
+			CollectLocked(lock, self, parkedframe, nullptr, nullptr);
+			break;
+		}
+
+		CollectionFinished.wait(lock);
+	}
+
+	self->Parked = false;
+}
+
+
+
+//
+// Strings whose address escapes to native code as a plain integer
+// must never move, so they are promoted out of the nursery at once.
+// The nursery copy is left forwarding to the promoted one, which
+// redirects the caller's own references at the next collection.
+// The mature copy is then kept out of compaction and deduplication.
+//
+const char* GC::Pin(const char* s)
+{
+	ThreadStringPool& pool = GetThreadPool();
+
+	std::lock_guard<std::mutex> lock(RegistryMutex);
+	for(const ThreadStringPool* owner : Pools)
+	{
+		if(owner->InNursery(s))
+		{
+			s = pool.Promote(s);
+			break;
+		}
+	}
+
+	if((Config.Compact || Config.Dedup) && !IsStaticString(s))
+		PinnedStrings.insert(s);
+
+	return s;
+}
+
+
+//
+// The interned copy of a string, made in the calling thread's pool
+// if there is none yet
+//
+const char* GC::Intern(const char* s)
+{
+	const StringHeader* header = ThreadStringPool::FindHeader(s);
+	if(header && header->IsInterned)
+		return s;
+
+	size_t length;
+	const char* chars = ThreadStringPool::GetChars(s, length);
+
+	ThreadStringPool& pool = GetThreadPool();
+	return Interned.Intern(chars, length, [&pool, chars, length](uint32_t hash) {
+		return pool.AllocInterned(chars, length, hash);
+	});
+}
+
+
+//
+// Allocate a zeroed instance of a structure in the calling thread's
+// pool. The size comes from the layout table, which has an entry for
+// every structure the compiler boxes.
+//
+void* GC::AllocStructure(uint32_t epochtype)
+{
+	const GCTypeLayout* layout = FindTypeLayout(epochtype);
+	assert(layout);
+	if(!layout)
+		return nullptr;
+
+	return GetThreadPool().AllocStructure(epochtype, layout->Size);
+}
+
+
+
+//
+// Bytes to allocate before the next sample is taken. The gaps are
+// drawn from an exponential distribution, which makes sampling a
+// Poisson process over allocated bytes.
+//
+size_t GC::NextSampleDistance()
+{
+	if(!Config.ProfileIntervalBytes)
+		return ~size_t(0);
+
+	std::exponential_distribution<double> distribution(1.0 / Config.ProfileIntervalBytes);
+	return static_cast<size_t>(distribution(SampleGenerator)) + 1;
+}
+
+//
+// Record a sampled allocation against the Epoch frames that led to
+// it. Runtime and OS frames are left out, so the innermost frame is
+// the Epoch code that called into the runtime. Returns the distance
+// to the next sample.
+//
+size_t GC::SampleAllocation(const char* s, size_t blocksize)
+{
+	if(!Profile)
+		return ~size_t(0);
+
+	uint64_t addresses[32];
+	unsigned count = StackWalk::CaptureReturnAddresses(addresses, 32);
+
+	uint64_t frames[AllocationProfile::MaxFrames];
+	unsigned framecount = 0;
+	for(unsigned i = 0; i < count && framecount < AllocationProfile::MaxFrames; ++i)
+	{
+		if(ProgramImageRange.Contains(reinterpret_cast<const char*>(addresses[i])))
+			frames[framecount++] = addresses[i];
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(ProfileMutex);
+		Profile->Record(s, blocksize, frames, framecount);
+	}
+
+	return NextSampleDistance();
+}
+
+//
+// Change in live bytes per allocation site since the last snapshot
+//
+std::string GC::GetProfileSnapshot()
+{
+	if(!Profile)
+		return "Allocation profiling is off; set EPOCH_GC_PROFILE_KB to enable it\n";
+
+	std::lock_guard<std::mutex> lock(ProfileMutex);
+	LoadProfileSymbols();
+	return Profile->FormatSnapshotDiff(ProfileSymbols);
+}
+
+
+std::string GC::GetStatistics()
+{
+	std::lock_guard<std::mutex> lock(StatsMutex);
+	return Stats.Format();
+}
+
+
+//
+// Set EPOCH_GC_SUMMARY in the environment to get the statistics on
+// stderr when the process exits, followed by the allocation sites if
+// profiling is on. This runs from DllMain, after any other threads
+// have been killed (possibly while holding one of our locks), so we
+// deliberately do not take any.
+//
+void GC::Shutdown()
+{
+	if(TraceLog && TraceLog != stderr)
+		fclose(TraceLog);
+
+	TraceLog = nullptr;
+
+	if(getenv("EPOCH_GC_SUMMARY"))
+		fputs(Stats.Format().c_str(), stderr);
+
+	if(Profile)
+	{
+		LoadProfileSymbols();
+		fputs(Profile->Format(ProfileSymbols).c_str(), stderr);
+	}
+}
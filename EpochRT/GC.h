@@ -1,13 +1,57 @@
 #pragma once
 
 
+#include <atomic>
+
+
 class ThreadStringPool;
+struct StackFrameCursor;
 
 
 namespace GC
 {
-	void Init(uint32_t gcsectionoffset);
+	void Init(uint32_t gcsectionoffset, const StackFrameCursor& entryframe);
+
+	void AttachThread(uint64_t stackbase);
+	void DetachThread();
+
+	ThreadStringPool& GetThreadPool();
+
+	void CollectStrings(const StackFrameCursor& callerframe);
+	void RequestCollection();
+	void ReportAllocation(size_t bytes);
+	void SweepSlice(ThreadStringPool* pool);
+
+	void Park(const StackFrameCursor& callerframe, const char** pin0, const char** pin1);
+
+	void EnterSafeRegion(const StackFrameCursor& callerframe);
+	void LeaveSafeRegion();
 
-	void CollectStrings(ThreadStringPool * pool, void* retaddr);
+	const char* Pin(const char* s);
+	const char* Intern(const char* s);
+
+	void* AllocStructure(uint32_t epochtype);
+
+	size_t NextSampleDistance();
+	size_t SampleAllocation(const char* s, size_t blocksize);
+	std::string GetProfileSnapshot();
+
+	std::string GetStatistics();
+	void Shutdown();
+
+	extern std::atomic<bool> CollectionRequested;
 }
 
+
+//
+// Poll for a pending collection at a runtime entry point. Strings
+// passed in by the caller may not be rooted in its frame, so the
+// addresses of the variables holding them are treated as roots for
+// as long as the thread is parked (and updated if they move).
+//
+#define GC_SAFEPOINT(pin0, pin1) \
+	do { \
+		if(GC::CollectionRequested.load(std::memory_order_acquire)) \
+			GC::Park(STACKWALK_CALLER_FRAME(), pin0, pin1); \
+	} while(false)
+
@@ -0,0 +1,156 @@
+#include "stdafx.h"
+#include "GCStats.h"
+
+
+#include <cmath>
+
+
+
+PauseHistogram::PauseHistogram()
+	: Count(0),
+	  TotalMs(0.0),
+	  MaxMs(0.0)
+{
+	for(unsigned i = 0; i < NumBuckets; ++i)
+		Buckets[i] = 0;
+}
+
+
+void PauseHistogram::Record(double ms)
+{
+	++Buckets[GetBucket(ms)];
+	++Count;
+	TotalMs += ms;
+	MaxMs = std::max(MaxMs, ms);
+}
+
+
+//
+// Report the upper edge of the bucket holding the requested
+// sample, clamped to the largest pause actually seen.
+//
+double PauseHistogram::GetPercentileMs(double percentile) const
+{
+	if(!Count)
+		return 0.0;
+
+	uint64_t rank = static_cast<uint64_t>(std::ceil(percentile / 100.0 * Count));
+	if(rank < 1)
+		rank = 1;
+
+	uint64_t seen = 0;
+	for(unsigned i = 0; i < NumBuckets; ++i)
+	{
+		seen += Buckets[i];
+		if(seen >= rank)
+			return std::min(GetBucketLimitMs(i), MaxMs);
+	}
+
+	return MaxMs;
+}
+
+
+unsigned PauseHistogram::GetBucket(double ms)
+{
+	double us = ms * 1000.0;
+	if(us < 1.0)
+		return 0;
+
+	unsigned bucket = 1 + static_cast<unsigned>(4.0 * std::log2(us));
+	return std::min(bucket, NumBuckets - 1);
+}
+
+double PauseHistogram::GetBucketLimitMs(unsigned bucket)
+{
+	return std::pow(2.0, bucket / 4.0) / 1000.0;
+}
+
+
+
+CollectorStats::CollectorStats()
+	: FramesWalked(0),
+	  RootsFound(0),
+	  EntriesFreed(0),
+	  BytesFreed(0),
+	  PoolBytes(0),
+	  EntriesMoved(0),
+	  ChunksReleased(0),
+	  CommittedBytes(0),
+	  InternedStrings(0),
+	  InternedDropped(0),
+	  DedupStrings(0),
+	  DedupBytesSaved(0)
+{
+}
+
+
+void CollectorStats::RecordCollection(const CollectionRecord& record)
+{
+	(record.Major ? MajorPauses : MinorPauses).Record(record.PauseMs);
+
+	FramesWalked += record.FramesWalked;
+	RootsFound += record.RootsFound;
+	EntriesFreed += record.EntriesFreed;
+	BytesFreed += record.BytesFreed;
+	PoolBytes = record.PoolBytesAfter;
+	EntriesMoved += record.EntriesMoved;
+	ChunksReleased += record.ChunksReleased;
+	CommittedBytes = record.CommittedBytes;
+	InternedStrings = record.InternedStrings;
+	InternedDropped += record.InternedDropped;
+	DedupStrings += record.DedupStrings;
+	DedupBytesSaved += record.DedupBytesSaved;
+}
+
+void CollectorStats::RecordSweepSlice(const CollectionRecord& record)
+{
+	SweepSlicePauses.Record(record.PauseMs);
+
+	EntriesFreed += record.EntriesFreed;
+	BytesFreed += record.BytesFreed;
+}
+
+
+//
+// One "name value" pair per line, so the output can be scraped
+// or diffed without any parsing beyond splitting on whitespace.
+// Pool size, committed memory and the number of interned strings
+// are as of the end of the last collection; the gap between the
+// first two is what fragmentation costs.
+//
+std::string CollectorStats::Format() const
+{
+	std::ostringstream out;
+
+	const PauseHistogram* histograms[] = { &MinorPauses, &MajorPauses, &SweepSlicePauses };
+	const char* names[] = { "minor", "major", "sweep_slice" };
+
+	for(unsigned i = 0; i < 3; ++i)
+	{
+		const PauseHistogram& h = *histograms[i];
+		double average = h.GetCount() ? h.GetTotalMs() / h.GetCount() : 0.0;
+
+		out << "gc." << names[i] << ".count " << h.GetCount() << "\n";
+		out << "gc." << names[i] << ".pause_total_ms " << h.GetTotalMs() << "\n";
+		out << "gc." << names[i] << ".pause_avg_ms " << average << "\n";
+		out << "gc." << names[i] << ".pause_p50_ms " << h.GetPercentileMs(50.0) << "\n";
+		out << "gc." << names[i] << ".pause_p90_ms " << h.GetPercentileMs(90.0) << "\n";
+		out << "gc." << names[i] << ".pause_p99_ms " << h.GetPercentileMs(99.0) << "\n";
+		out << "gc." << names[i] << ".pause_max_ms " << h.GetMaxMs() << "\n";
+	}
+
+	out << "gc.frames_walked " << FramesWalked << "\n";
+	out << "gc.roots_found " << RootsFound << "\n";
+	out << "gc.entries_freed " << EntriesFreed << "\n";
+	out << "gc.bytes_freed " << BytesFreed << "\n";
+	out << "gc.pool_bytes " << PoolBytes << "\n";
+	out << "gc.committed_bytes " << CommittedBytes << "\n";
+	out << "gc.entries_moved " << EntriesMoved << "\n";
+	out << "gc.chunks_released " << ChunksReleased << "\n";
+	out << "gc.interned_strings " << InternedStrings << "\n";
+	out << "gc.interned_dropped " << InternedDropped << "\n";
+	out << "gc.dedup_strings " << DedupStrings << "\n";
+	out << "gc.dedup_bytes_saved " << DedupBytesSaved << "\n";
+
+	return out.str();
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+
+//
+// Log-scale histogram of collector pause times
+//
+// Buckets are a quarter of an octave wide, starting at one
+// microsecond, which keeps percentile estimates within about
+// 20% of the true value without having to keep every sample.
+//
+class PauseHistogram
+{
+public:
+	PauseHistogram();
+
+public:
+	void Record(double ms);
+
+	double GetPercentileMs(double percentile) const;
+
+	uint64_t GetCount() const
+	{
+		return Count;
+	}
+
+	double GetTotalMs() const
+	{
+		return TotalMs;
+	}
+
+	double GetMaxMs() const
+	{
+		return MaxMs;
+	}
+
+private:
+	static unsigned GetBucket(double ms);
+	static double GetBucketLimitMs(unsigned bucket);
+
+private:
+	static const unsigned NumBuckets = 100;
+
+	uint64_t Buckets[NumBuckets];
+	uint64_t Count;
+	double TotalMs;
+	double MaxMs;
+};
+
+
+
+//
+// What one collection (or one incremental sweep slice) did
+//
+struct CollectionRecord
+{
+	bool Major;
+	double PauseMs;
+
+	uint64_t FramesWalked;
+	uint64_t RootsFound;
+
+	uint64_t EntriesFreed;
+	uint64_t BytesFreed;
+
+	uint64_t PoolBytesBefore;
+	uint64_t PoolBytesAfter;
+
+	uint64_t EntriesMoved;
+	uint64_t ChunksReleased;
+	uint64_t CommittedBytes;
+
+	uint64_t InternedStrings;
+	uint64_t InternedDropped;
+
+	uint64_t DedupStrings;
+	uint64_t DedupBytesSaved;
+};
+
+
+//
+// Running totals over the life of the process
+//
+// Collections and sweep slices are kept apart, since a slice
+// frees memory but has no roots to find, and mixing their pause
+// times would hide the cost of the stop-the-world part.
+//
+class CollectorStats
+{
+public:
+	CollectorStats();
+
+public:
+	void RecordCollection(const CollectionRecord& record);
+	void RecordSweepSlice(const CollectionRecord& record);
+
+	std::string Format() const;
+
+private:
+	PauseHistogram MinorPauses;
+	PauseHistogram MajorPauses;
+	PauseHistogram SweepSlicePauses;
+
+	uint64_t FramesWalked;
+	uint64_t RootsFound;
+	uint64_t EntriesFreed;
+	uint64_t BytesFreed;
+	uint64_t PoolBytes;
+	uint64_t EntriesMoved;
+	uint64_t ChunksReleased;
+	uint64_t CommittedBytes;
+	uint64_t InternedStrings;
+	uint64_t InternedDropped;
+	uint64_t DedupStrings;
+	uint64_t DedupBytesSaved;
+};
+
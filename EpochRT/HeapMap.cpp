@@ -0,0 +1,64 @@
+#include "stdafx.h"
+#include "HeapMap.h"
+
+
+
+std::atomic<std::atomic<uint64_t>*> HeapMap::Leaves[HeapMap::NumLeaves];
+
+
+namespace
+{
+
+	std::atomic<uint64_t>* GetOrCreateLeaf(uint64_t leafindex)
+	{
+		std::atomic<uint64_t>* leaf = HeapMap::Leaves[leafindex].load(std::memory_order_acquire);
+		if(leaf)
+			return leaf;
+
+		std::atomic<uint64_t>* created = new std::atomic<uint64_t>[HeapMap::WordsPerLeaf];
+		for(size_t i = 0; i < HeapMap::WordsPerLeaf; ++i)
+			created[i].store(0, std::memory_order_relaxed);
+
+		// Another thread may have beaten us to it; leaves are never
+		// freed, so whichever one was installed stays valid for good
+		if(!HeapMap::Leaves[leafindex].compare_exchange_strong(leaf, created, std::memory_order_acq_rel))
+		{
+			delete [] created;
+			return leaf;
+		}
+
+		return created;
+	}
+
+	template<typename FuncT>
+	void ForEachGranule(const void* base, size_t size, FuncT func)
+	{
+		uint64_t begin = reinterpret_cast<uint64_t>(base) >> HeapMap::GranuleShift;
+		uint64_t end = (reinterpret_cast<uint64_t>(base) + size + (uint64_t(1) << HeapMap::GranuleShift) - 1) >> HeapMap::GranuleShift;
+
+		for(uint64_t granule = begin; granule < end; ++granule)
+		{
+			uint64_t bit = granule & ((uint64_t(1) << HeapMap::LeafShift) - 1);
+			func(granule >> HeapMap::LeafShift, bit / 64, uint64_t(1) << (bit % 64));
+		}
+	}
+
+}
+
+
+void HeapMap::Register(const void* base, size_t size)
+{
+	ForEachGranule(base, size, [](uint64_t leafindex, size_t word, uint64_t mask) {
+		assert(leafindex < NumLeaves);
+		GetOrCreateLeaf(leafindex)[word].fetch_or(mask, std::memory_order_release);
+	});
+}
+
+void HeapMap::Unregister(const void* base, size_t size)
+{
+	ForEachGranule(base, size, [](uint64_t leafindex, size_t word, uint64_t mask) {
+		std::atomic<uint64_t>* leaf = Leaves[leafindex].load(std::memory_order_acquire);
+		leaf[word].fetch_and(~mask, std::memory_order_release);
+	});
+}
+
@@ -0,0 +1,52 @@
+#pragma once
+
+
+#include <atomic>
+
+
+//
+// Which parts of the address space belong to the string heap
+//
+// Epoch strings are plain character pointers, and one may just as
+// well point at a literal in the program image or at memory that
+// native code handed back, neither of which has a header in front
+// of it. Every region the pools get from the OS is recorded here at
+// the granularity of VirtualAlloc reservations (64KB), so a pointer
+// can be checked for a header with a couple of loads and no locks.
+// Reservations never share a granule, so a marked granule holds
+// nothing but our blocks.
+//
+// The map is two levels deep: a fixed table of leaves, each one a
+// bitmap covering 4GB of address space, allocated on first use.
+//
+namespace HeapMap
+{
+	const unsigned GranuleShift = 16;
+	const unsigned LeafShift = 16;
+	const unsigned AddressBits = 47;
+
+	const size_t NumLeaves = size_t(1) << (AddressBits - GranuleShift - LeafShift);
+	const size_t WordsPerLeaf = (size_t(1) << LeafShift) / 64;
+
+	extern std::atomic<std::atomic<uint64_t>*> Leaves[NumLeaves];
+
+	void Register(const void* base, size_t size);
+	void Unregister(const void* base, size_t size);
+
+
+	inline bool Contains(const void* p)
+	{
+		uint64_t granule = reinterpret_cast<uint64_t>(p) >> GranuleShift;
+		uint64_t leafindex = granule >> LeafShift;
+		if(leafindex >= NumLeaves)
+			return false;
+
+		const std::atomic<uint64_t>* leaf = Leaves[leafindex].load(std::memory_order_acquire);
+		if(!leaf)
+			return false;
+
+		uint64_t bit = granule & ((uint64_t(1) << LeafShift) - 1);
+		return ((leaf[bit / 64].load(std::memory_order_relaxed) >> (bit % 64)) & 1) != 0;
+	}
+}
+
@@ -0,0 +1,123 @@
+#include "stdafx.h"
+#include "InternTable.h"
+
+
+
+const char InternTable::Tombstone[1] = { 0 };
+
+
+
+InternTable::Table::Table(size_t capacity)
+	: Capacity(capacity),
+	  Used(0),
+	  Slots(new Slot[capacity])
+{
+	for(size_t i = 0; i < capacity; ++i)
+	{
+		Slots[i].String.store(nullptr, std::memory_order_relaxed);
+		Slots[i].Hash.store(0, std::memory_order_relaxed);
+	}
+}
+
+InternTable::Table::~Table()
+{
+	delete [] Slots;
+}
+
+
+InternTable::InternTable()
+	: Current(new Table(InitialCapacity)),
+	  Count(0)
+{
+}
+
+InternTable::~InternTable()
+{
+	ReleaseRetiredTables();
+	delete Current.load(std::memory_order_relaxed);
+}
+
+
+//
+// Probe for an entry with the same characters. The hash is checked
+// first, and the characters only compared when it matches.
+//
+const char* InternTable::Find(const Table* table, const char* chars, size_t length, uint32_t hash)
+{
+	size_t mask = table->Capacity - 1;
+	for(size_t i = hash & mask; ; i = (i + 1) & mask)
+	{
+		const char* s = table->Slots[i].String.load(std::memory_order_acquire);
+		if(!s)
+			return nullptr;
+
+		if(s == Tombstone || table->Slots[i].Hash.load(std::memory_order_relaxed) != hash)
+			continue;
+
+		if(ThreadStringPool::GetHeader(s)->Length == length && memcmp(s, chars, length) == 0)
+			return s;
+	}
+}
+
+//
+// Add an entry known not to be present. The hash is stored before
+// the string is published, so that a concurrent lookup which sees
+// the string also sees its hash. Cleared slots are reused, which
+// is safe since a lookup never stops at one.
+//
+void InternTable::Insert(Table* table, const char* s, uint32_t hash)
+{
+	size_t mask = table->Capacity - 1;
+	for(size_t i = hash & mask; ; i = (i + 1) & mask)
+	{
+		const char* existing = table->Slots[i].String.load(std::memory_order_relaxed);
+		if(existing && existing != Tombstone)
+			continue;
+
+		if(!existing)
+			++table->Used;
+
+		table->Slots[i].Hash.store(hash, std::memory_order_relaxed);
+		table->Slots[i].String.store(s, std::memory_order_release);
+		return;
+	}
+}
+
+
+//
+// Move the live entries to a new table at least four times their
+// number in size, which also drops the tombstones. The old table is
+// left for lookups already under way.
+//
+void InternTable::Grow()
+{
+	Table* old = Current.load(std::memory_order_relaxed);
+
+	size_t capacity = InitialCapacity;
+	while(capacity < (Count + 1) * 4)
+		capacity *= 2;
+
+	Table* table = new Table(capacity);
+	for(size_t i = 0; i < old->Capacity; ++i)
+	{
+		const char* s = old->Slots[i].String.load(std::memory_order_relaxed);
+		if(s && s != Tombstone)
+			Insert(table, s, old->Slots[i].Hash.load(std::memory_order_relaxed));
+	}
+
+	Current.store(table, std::memory_order_release);
+	Retired.push_back(old);
+}
+
+//
+// Free the tables replaced since the last call. Only safe with every
+// mutator parked, or at least none of them in a lookup.
+//
+void InternTable::ReleaseRetiredTables()
+{
+	for(Table* table : Retired)
+		delete table;
+
+	Retired.clear();
+}
+
@@ -0,0 +1,170 @@
+#pragma once
+
+
+#include "StringPool.h"
+
+
+#include <atomic>
+#include <mutex>
+
+
+//
+// Set of interned strings, shared by all threads
+//
+// Open addressing with linear probing, keyed by the full hash of
+// each string's characters. Lookups take no lock, so any number of
+// threads may search at once; insertions are serialized, and a miss
+// only counts once it has been repeated under the lock. Growing the
+// table builds a bigger copy and publishes it with a single store,
+// so a thread still probing the old one sees a consistent if stale
+// picture. Old tables are kept until the next collection, when no
+// thread can be in the middle of a lookup.
+//
+// The strings themselves live in the ordinary pools, and the table
+// does not keep them alive. The collector clears the entries whose
+// strings were not reached by a major collection, and redirects the
+// rest if compaction moves them.
+//
+class InternTable
+{
+public:
+	InternTable();
+	~InternTable();
+
+	InternTable(const InternTable&) = delete;
+	InternTable& operator = (const InternTable&) = delete;
+
+public:
+	template<typename AllocT>
+	const char* Intern(const char* chars, size_t length, AllocT alloc);
+
+	template<typename PredT>
+	size_t RemoveIf(PredT isdead);
+
+	template<typename FuncT>
+	void ForEachEntry(FuncT func);
+
+	void ReleaseRetiredTables();
+
+	size_t GetCount() const
+	{
+		return Count;
+	}
+
+public:
+	static const size_t InitialCapacity = 1024;
+
+private:
+	struct Slot
+	{
+		std::atomic<const char*> String;
+		std::atomic<uint32_t> Hash;
+	};
+
+	struct Table
+	{
+		explicit Table(size_t capacity);
+		~Table();
+
+		size_t Capacity;
+		size_t Used;
+		Slot* Slots;
+	};
+
+	static const char* Find(const Table* table, const char* chars, size_t length, uint32_t hash);
+	static void Insert(Table* table, const char* s, uint32_t hash);
+
+	void Grow();
+
+private:
+	std::atomic<Table*> Current;
+	std::vector<Table*> Retired;
+
+	std::mutex InsertMutex;
+	size_t Count;
+
+	// Marks a cleared entry, which lookups have to probe past
+	static const char Tombstone[1];
+};
+
+
+
+//
+// The interned string with the given characters. If there is none
+// yet, alloc is called with the hash of the characters to make one,
+// which is then added to the table.
+//
+template<typename AllocT>
+const char* InternTable::Intern(const char* chars, size_t length, AllocT alloc)
+{
+	uint32_t hash = ThreadStringPool::HashChars(chars, length);
+
+	const char* found = Find(Current.load(std::memory_order_acquire), chars, length, hash);
+	if(found)
+		return found;
+
+	std::lock_guard<std::mutex> lock(InsertMutex);
+
+	Table* table = Current.load(std::memory_order_relaxed);
+	found = Find(table, chars, length, hash);
+	if(found)
+		return found;
+
+	// Tombstones count as used, so that probe chains stay short
+	if((table->Used + 1) * 2 > table->Capacity)
+	{
+		Grow();
+		table = Current.load(std::memory_order_relaxed);
+	}
+
+	const char* interned = alloc(hash);
+	Insert(table, interned, hash);
+	++Count;
+	return interned;
+}
+
+//
+// Clear every entry for which the predicate holds, returning the
+// number cleared. Only safe with every mutator parked.
+//
+template<typename PredT>
+size_t InternTable::RemoveIf(PredT isdead)
+{
+	Table* table = Current.load(std::memory_order_relaxed);
+
+	size_t removed = 0;
+	for(size_t i = 0; i < table->Capacity; ++i)
+	{
+		const char* s = table->Slots[i].String.load(std::memory_order_relaxed);
+		if(s && s != Tombstone && isdead(s))
+		{
+			table->Slots[i].String.store(Tombstone, std::memory_order_relaxed);
+			++removed;
+		}
+	}
+
+	Count -= removed;
+	return removed;
+}
+
+//
+// Hand each entry to the given function, which may change it to
+// point at a moved copy of the same string. Only safe with every
+// mutator parked.
+//
+template<typename FuncT>
+void InternTable::ForEachEntry(FuncT func)
+{
+	Table* table = Current.load(std::memory_order_relaxed);
+
+	for(size_t i = 0; i < table->Capacity; ++i)
+	{
+		const char* s = table->Slots[i].String.load(std::memory_order_relaxed);
+		if(s && s != Tombstone)
+		{
+			func(s);
+			table->Slots[i].String.store(s, std::memory_order_relaxed);
+		}
+	}
+}
+
@@ -0,0 +1,70 @@
+#include "stdafx.h"
+#include "LargeObjectSpace.h"
+#include "HeapMap.h"
+
+
+
+LargeObjectSpace::LargeObjectSpace()
+	: LiveBytes(0),
+	  CommittedBytes(0)
+{
+}
+
+LargeObjectSpace::~LargeObjectSpace()
+{
+	for(auto& entry : Blocks)
+	{
+		HeapMap::Unregister(entry.first, entry.second);
+		::VirtualFree(entry.first, 0, MEM_RELEASE);
+	}
+}
+
+
+//
+// Allocate storage for a block of the given total size, header
+// included. The header is left for the caller to fill in.
+//
+StringHeader* LargeObjectSpace::Alloc(size_t blocksize)
+{
+	void* mem = ::VirtualAlloc(nullptr, blocksize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	assert(mem);
+
+	StringHeader* header = reinterpret_cast<StringHeader*>(mem);
+	Blocks.emplace(header, blocksize);
+	HeapMap::Register(header, blocksize);
+
+	LiveBytes += blocksize;
+	CommittedBytes += (blocksize + PageSize - 1) & ~(PageSize - 1);
+	return header;
+}
+
+void LargeObjectSpace::Free(StringHeader* header)
+{
+	auto iter = Blocks.find(header);
+	Unmap(iter->first, iter->second);
+	Blocks.erase(iter);
+}
+
+
+//
+// Mappings always start on a page boundary, which rules out most
+// other pointers before we get as far as the hash lookup.
+//
+bool LargeObjectSpace::Owns(const StringHeader* header) const
+{
+	if(reinterpret_cast<uintptr_t>(header) & (PageSize - 1))
+		return false;
+
+	return Blocks.count(const_cast<StringHeader*>(header)) != 0;
+}
+
+
+void LargeObjectSpace::Unmap(StringHeader* header, size_t blocksize)
+{
+	LiveBytes -= blocksize;
+	CommittedBytes -= (blocksize + PageSize - 1) & ~(PageSize - 1);
+
+	HeapMap::Unregister(header, blocksize);
+	::VirtualFree(header, 0, MEM_RELEASE);
+}
+
@@ -0,0 +1,99 @@
+#pragma once
+
+
+#include "StringHeader.h"
+#include "SlabAllocator.h"
+
+
+#include <unordered_map>
+
+
+//
+// Storage for string blocks too big for a slab slot
+//
+// Each block is given its own mapping straight from the OS, so its
+// memory goes back the moment the block is swept instead of staying
+// behind in the C heap, and one huge string never holds on to a
+// slab chunk. The mapping is registered with the heap map, so that
+// FindHeader() sees every string whatever its size. Blocks here
+// never move. Only blocks over the largest slab slot (16KB) come
+// here, so the 64KB of address space each mapping takes up is at
+// most four times the size of its block; only whole pages of the
+// block itself are committed.
+//
+// Buffers too big for a slab slot are kept here as well, whatever
+// their size, since they must not move either.
+//
+class LargeObjectSpace
+{
+public:
+	LargeObjectSpace();
+	~LargeObjectSpace();
+
+	LargeObjectSpace(const LargeObjectSpace&) = delete;
+	LargeObjectSpace& operator = (const LargeObjectSpace&) = delete;
+
+public:
+	StringHeader* Alloc(size_t blocksize);
+	void Free(StringHeader* header);
+
+	bool Owns(const StringHeader* header) const;
+
+	bool IsEmpty() const
+	{
+		return Blocks.empty();
+	}
+
+	size_t GetLiveBytes() const
+	{
+		return LiveBytes;
+	}
+
+	size_t GetCommittedBytes() const
+	{
+		return CommittedBytes;
+	}
+
+	template<typename PredT>
+	size_t Sweep(PredT isgarbage);
+
+public:
+	static const size_t MinBlockSize = SlabAllocator::MaxSlotSize + 1;
+	static const size_t PageSize = 4096;
+
+private:
+	void Unmap(StringHeader* header, size_t blocksize);
+
+private:
+	std::unordered_map<StringHeader*, size_t> Blocks;
+
+	size_t LiveBytes;
+	size_t CommittedBytes;
+};
+
+
+
+//
+// Unmap every block for which the predicate holds, returning the
+// number of blocks freed.
+//
+template<typename PredT>
+size_t LargeObjectSpace::Sweep(PredT isgarbage)
+{
+	size_t freed = 0;
+
+	for(auto iter = Blocks.begin(); iter != Blocks.end(); )
+	{
+		if(isgarbage(iter->first))
+		{
+			Unmap(iter->first, iter->second);
+			iter = Blocks.erase(iter);
+			++freed;
+		}
+		else
+			++iter;
+	}
+
+	return freed;
+}
+
@@ -0,0 +1,259 @@
+#include "stdafx.h"
+#include "MappedFileSpace.h"
+#include "HeapMap.h"
+
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+
+namespace
+{
+
+	static_assert(MappedFileSpace::HeaderSpace == (size_t(1) << HeapMap::GranuleShift), "Header space must fill exactly one heap map granule");
+
+	char* GetView(StringHeader* header)
+	{
+		return reinterpret_cast<char*>(header + 1);
+	}
+
+#ifndef _WIN32
+	//
+	// Everything reserved for a view, header space included, which is
+	// rounded out to whole granules so that nothing else ever shares
+	// one with it
+	//
+	size_t GetSpan(size_t filesize)
+	{
+		const size_t granule = MappedFileSpace::HeaderSpace;
+		return granule + ((filesize + 1 + granule - 1) & ~(granule - 1));
+	}
+#endif
+
+}
+
+
+
+MappedFileSpace::MappedFileSpace()
+	: LiveBytes(0)
+{
+}
+
+MappedFileSpace::~MappedFileSpace()
+{
+	for(auto& entry : Views)
+		Unmap(entry.first, entry.second);
+}
+
+
+//
+// Map the named file, returning the header in front of its first
+// byte. The header is left for the caller to fill in. Returns null
+// if the file was not mapped, with filesize set to UnreadableFile
+// if it could not even be opened; block lengths are 32 bits, so
+// that goes for anything of 4GB or more too.
+//
+StringHeader* MappedFileSpace::Map(const char* filename, size_t& filesize)
+{
+	char* view = nullptr;
+
+#ifdef _WIN32
+	HANDLE file = ::CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(file == INVALID_HANDLE_VALUE)
+	{
+		filesize = UnreadableFile;
+		return nullptr;
+	}
+
+	LARGE_INTEGER size;
+	if(!::GetFileSizeEx(file, &size) || size.QuadPart > UINT32_MAX)
+	{
+		::CloseHandle(file);
+		filesize = UnreadableFile;
+		return nullptr;
+	}
+
+	filesize = static_cast<size_t>(size.QuadPart);
+
+	// Past the end of the last page there is nothing mapped to read
+	// a terminator from
+	if(filesize == 0 || filesize % PageSize == 0)
+	{
+		::CloseHandle(file);
+		return nullptr;
+	}
+
+	// The mapping holds on to the file, and the view to the mapping
+	HANDLE mapping = ::CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	::CloseHandle(file);
+
+	if(!mapping)
+		return nullptr;
+
+	// The header space and the view cannot be reserved in one go, so
+	// find a hole big enough for both and take it piece by piece. If
+	// another thread gets into the hole in between, look for another.
+	for(unsigned attempt = 0; !view && attempt < MaxPlacementAttempts; ++attempt)
+	{
+		char* hole = static_cast<char*>(::VirtualAlloc(nullptr, HeaderSpace + filesize, MEM_RESERVE, PAGE_NOACCESS));
+		if(!hole)
+			break;
+
+		::VirtualFree(hole, 0, MEM_RELEASE);
+
+		if(!::VirtualAlloc(hole, HeaderSpace, MEM_RESERVE, PAGE_NOACCESS))
+			continue;
+
+		view = static_cast<char*>(::MapViewOfFileEx(mapping, FILE_MAP_READ, 0, 0, 0, hole + HeaderSpace));
+		if(!view)
+			::VirtualFree(hole, 0, MEM_RELEASE);
+	}
+
+	::CloseHandle(mapping);
+
+	if(!view)
+		return nullptr;
+
+	::VirtualAlloc(view - PageSize, PageSize, MEM_COMMIT, PAGE_READWRITE);
+#else
+	int file = ::open(filename, O_RDONLY);
+	if(file < 0)
+	{
+		filesize = UnreadableFile;
+		return nullptr;
+	}
+
+	struct stat info;
+	if(::fstat(file, &info) != 0 || static_cast<uint64_t>(info.st_size) > UINT32_MAX)
+	{
+		::close(file);
+		filesize = UnreadableFile;
+		return nullptr;
+	}
+
+	filesize = static_cast<size_t>(info.st_size);
+	if(filesize == 0)
+	{
+		::close(file);
+		return nullptr;
+	}
+
+	// Anonymous pages after the file supply the terminator even when
+	// it fills its last page. Reserve a granule extra, to line the
+	// span up on one, then give back what is left over either side.
+	size_t span = GetSpan(filesize);
+	void* reserved = ::mmap(nullptr, span + HeaderSpace, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(reserved == MAP_FAILED)
+	{
+		::close(file);
+		return nullptr;
+	}
+
+	char* first = static_cast<char*>(reserved);
+	char* base = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(first) + HeaderSpace - 1) & ~uintptr_t(HeaderSpace - 1));
+	if(base != first)
+		::munmap(first, base - first);
+	::munmap(base + span, HeaderSpace - (base - first));
+
+	void* mapped = ::mmap(base + HeaderSpace, filesize, PROT_READ, MAP_PRIVATE | MAP_FIXED, file, 0);
+	::close(file);
+
+	if(mapped == MAP_FAILED)
+	{
+		::munmap(base, span);
+		return nullptr;
+	}
+
+	view = static_cast<char*>(mapped);
+	::mprotect(view - PageSize, PageSize, PROT_READ | PROT_WRITE);
+#endif
+
+	StringHeader* header = reinterpret_cast<StringHeader*>(view) - 1;
+	Views.emplace(header, filesize);
+	HeapMap::Register(view - HeaderSpace, HeaderSpace + filesize);
+
+	LiveBytes += filesize;
+	return header;
+}
+
+
+//
+// Views always start on a granule boundary, which rules out nearly
+// every other pointer before we get as far as the hash lookup.
+//
+bool MappedFileSpace::Owns(const StringHeader* header) const
+{
+	if(reinterpret_cast<uintptr_t>(header + 1) & (HeaderSpace - 1))
+		return false;
+
+	return Views.count(const_cast<StringHeader*>(header)) != 0;
+}
+
+
+//
+// Fallback for files that are not mapped: read the whole file into
+// storage the caller has already allocated. Returns the number of
+// bytes read, which is short of the file size only if the file
+// shrank or could not be read to the end.
+//
+size_t MappedFileSpace::ReadWhole(const char* filename, char* target, size_t filesize)
+{
+	size_t total = 0;
+
+#ifdef _WIN32
+	HANDLE file = ::CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(file == INVALID_HANDLE_VALUE)
+		return 0;
+
+	while(total < filesize)
+	{
+		DWORD chunk = static_cast<DWORD>(std::min<size_t>(filesize - total, 0x40000000));
+		DWORD read = 0;
+		if(!::ReadFile(file, target + total, chunk, &read, nullptr) || read == 0)
+			break;
+
+		total += read;
+	}
+
+	::CloseHandle(file);
+#else
+	int file = ::open(filename, O_RDONLY);
+	if(file < 0)
+		return 0;
+
+	while(total < filesize)
+	{
+		ssize_t read = ::read(file, target + total, filesize - total);
+		if(read <= 0)
+			break;
+
+		total += static_cast<size_t>(read);
+	}
+
+	::close(file);
+#endif
+
+	return total;
+}
+
+
+void MappedFileSpace::Unmap(StringHeader* header, size_t filesize)
+{
+	char* view = GetView(header);
+
+	LiveBytes -= filesize;
+	HeapMap::Unregister(view - HeaderSpace, HeaderSpace + filesize);
+
+#ifdef _WIN32
+	::UnmapViewOfFile(view);
+	::VirtualFree(view - HeaderSpace, 0, MEM_RELEASE);
+#else
+	::munmap(view - HeaderSpace, GetSpan(filesize));
+#endif
+}
+
@@ -0,0 +1,105 @@
+#pragma once
+
+
+#include "StringHeader.h"
+
+
+#include <unordered_map>
+
+
+//
+// Read-only views of whole files, handed out as strings
+//
+// Each file is mapped directly after a 64KB reservation of its own,
+// whose last page holds the block header. The first byte of the file
+// lands where a pooled string's characters would be, so everything
+// that finds a header by pointer subtraction works unchanged, and the
+// characters are never copied: they are the OS's cached pages of the
+// file, shared with any other process reading it. The rest of the
+// last page of a view reads as zeroes, which terminates the string.
+//
+// A file that exactly fills its last page has nowhere to put that
+// terminator, and is not mapped; nor is an empty one. The caller is
+// expected to read those into an ordinary block instead.
+//
+// Views never move, and are unmapped when the collector finds them
+// unreachable, like large objects.
+//
+class MappedFileSpace
+{
+public:
+	MappedFileSpace();
+	~MappedFileSpace();
+
+	MappedFileSpace(const MappedFileSpace&) = delete;
+	MappedFileSpace& operator = (const MappedFileSpace&) = delete;
+
+public:
+	StringHeader* Map(const char* filename, size_t& filesize);
+
+	bool Owns(const StringHeader* header) const;
+
+	bool IsEmpty() const
+	{
+		return Views.empty();
+	}
+
+	size_t GetLiveBytes() const
+	{
+		return LiveBytes;
+	}
+
+	size_t GetCommittedBytes() const
+	{
+		return Views.size() * PageSize;
+	}
+
+	template<typename PredT>
+	size_t Sweep(PredT isgarbage);
+
+	static size_t ReadWhole(const char* filename, char* target, size_t filesize);
+
+public:
+	// Returned as the size of a file that could not be opened
+	static const size_t UnreadableFile = ~size_t(0);
+
+	static const size_t HeaderSpace = 64 * 1024;
+	static const size_t PageSize = 4096;
+
+	static const unsigned MaxPlacementAttempts = 16;
+
+private:
+	void Unmap(StringHeader* header, size_t filesize);
+
+private:
+	std::unordered_map<StringHeader*, size_t> Views;
+
+	size_t LiveBytes;
+};
+
+
+
+//
+// Unmap every view for which the predicate holds, returning the
+// number of views freed.
+//
+template<typename PredT>
+size_t MappedFileSpace::Sweep(PredT isgarbage)
+{
+	size_t freed = 0;
+
+	for(auto iter = Views.begin(); iter != Views.end(); )
+	{
+		if(isgarbage(iter->first))
+		{
+			Unmap(iter->first, iter->second);
+			iter = Views.erase(iter);
+			++freed;
+		}
+		else
+			++iter;
+	}
+
+	return freed;
+}
+
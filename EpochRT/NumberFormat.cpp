@@ -0,0 +1,709 @@
+#include "stdafx.h"
+#include "NumberFormat.h"
+
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+
+
+namespace
+{
+
+	const char DigitPairs[] =
+		"0001020304050607080910111213141516171819"
+		"2021222324252627282930313233343536373839"
+		"4041424344454647484950515253545556575859"
+		"6061626364656667686970717273747576777879"
+		"8081828384858687888990919293949596979899";
+
+
+	//
+	// Digits of an unsigned value, written two at a time from the
+	// right into the end of a scratch buffer, then moved into place
+	//
+	template<typename UIntT>
+	size_t FormatDigits(char* out, UIntT value)
+	{
+		char scratch[NumberFormat::MaxIntegerChars];
+		char* p = scratch + sizeof(scratch);
+
+		while(value >= 100)
+		{
+			unsigned pair = static_cast<unsigned>(value % 100);
+			value /= 100;
+
+			p -= 2;
+			memcpy(p, DigitPairs + pair * 2, 2);
+		}
+
+		if(value >= 10)
+		{
+			p -= 2;
+			memcpy(p, DigitPairs + value * 2, 2);
+		}
+		else
+		{
+			*--p = static_cast<char>('0' + value);
+		}
+
+		size_t length = static_cast<size_t>(scratch + sizeof(scratch) - p);
+		memcpy(out, p, length);
+		return length;
+	}
+
+
+	//
+	// Shortest round trip digits for a float, after Ulf Adams' Ryu
+	//
+	// The value and the halfway points to its neighbours are scaled by
+	// a power of ten using 64-bit approximations of powers of five that
+	// are exact enough for a float's 24 bits. Digits are then dropped
+	// from all three together for as long as the result stays between
+	// the halfway points, with the last one dropped deciding rounding.
+	//
+	const int FloatMantissaBits = 23;
+	const int FloatExponentBits = 8;
+	const int FloatBias = 127;
+
+	const int Pow5InverseBitCount = 59;
+	const int Pow5BitCount = 61;
+
+	// 2^(bits(5^i) - 1 + 59) / 5^i, rounded up
+	const uint64_t Pow5InverseSplit[] =
+	{
+		0x0800000000000001ULL, 0x0666666666666667ULL, 0x051eb851eb851eb9ULL,
+		0x04189374bc6a7efaULL, 0x068db8bac710cb2aULL, 0x053e2d6238da3c22ULL,
+		0x0431bde82d7b634eULL, 0x06b5fca6af2bd216ULL, 0x055e63b88c230e78ULL,
+		0x044b82fa09b5a52dULL, 0x06df37f675ef6eaeULL, 0x057f5ff85e592558ULL,
+		0x0465e6604b7a8447ULL, 0x0709709a125da071ULL, 0x05a126e1a84ae6c1ULL,
+		0x0480ebe7b9d58567ULL, 0x0734aca5f6226f0bULL, 0x05c3bd5191b525a3ULL,
+		0x049c97747490eae9ULL, 0x0760f253edb4ab0eULL, 0x05e72843249088d8ULL,
+		0x04b8ed0283a6d3e0ULL, 0x078e480405d7b966ULL, 0x060b6cd004ac9452ULL,
+		0x04d5f0a66a23a9dbULL, 0x07bcb43d769f762bULL, 0x063090312bb2c4efULL,
+		0x04f3a68dbc8f03f3ULL, 0x07ec3daf94180651ULL, 0x065697bfa9acd1daULL,
+		0x051212ffbaf0a7e2ULL,
+	};
+
+	// The top 61 bits of 5^i
+	const uint64_t Pow5Split[] =
+	{
+		0x1000000000000000ULL, 0x1400000000000000ULL, 0x1900000000000000ULL,
+		0x1f40000000000000ULL, 0x1388000000000000ULL, 0x186a000000000000ULL,
+		0x1e84800000000000ULL, 0x1312d00000000000ULL, 0x17d7840000000000ULL,
+		0x1dcd650000000000ULL, 0x12a05f2000000000ULL, 0x174876e800000000ULL,
+		0x1d1a94a200000000ULL, 0x12309ce540000000ULL, 0x16bcc41e90000000ULL,
+		0x1c6bf52634000000ULL, 0x11c37937e0800000ULL, 0x16345785d8a00000ULL,
+		0x1bc16d674ec80000ULL, 0x1158e460913d0000ULL, 0x15af1d78b58c4000ULL,
+		0x1b1ae4d6e2ef5000ULL, 0x10f0cf064dd59200ULL, 0x152d02c7e14af680ULL,
+		0x1a784379d99db420ULL, 0x108b2a2c28029094ULL, 0x14adf4b7320334b9ULL,
+		0x19d971e4fe8401e7ULL, 0x1027e72f1f128130ULL, 0x1431e0fae6d7217cULL,
+		0x193e5939a08ce9dbULL, 0x1f8def8808b02452ULL, 0x13b8b5b5056e16b3ULL,
+		0x18a6e32246c99c60ULL, 0x1ed09bead87c0378ULL, 0x13426172c74d822bULL,
+		0x1812f9cf7920e2b6ULL, 0x1e17b84357691b64ULL, 0x12ced32a16a1b11eULL,
+		0x178287f49c4a1d66ULL, 0x1d6329f1c35ca4bfULL, 0x125dfa371a19e6f7ULL,
+		0x16f578c4e0a060b5ULL, 0x1cb2d6f618c878e3ULL, 0x11efc659cf7d4b8dULL,
+		0x166bb7f0435c9e71ULL, 0x1c06a5ec5433c60dULL, 0x118427b3b4a05bc8ULL,
+	};
+
+
+	inline int Pow5Bits(int e)
+	{
+		return static_cast<int>((static_cast<uint32_t>(e) * 1217359) >> 19) + 1;
+	}
+
+	inline uint32_t Log10Pow2(int e)
+	{
+		return (static_cast<uint32_t>(e) * 78913) >> 18;
+	}
+
+	inline uint32_t Log10Pow5(int e)
+	{
+		return (static_cast<uint32_t>(e) * 732923) >> 20;
+	}
+
+	inline uint32_t Pow5Factor(uint32_t value)
+	{
+		uint32_t count = 0;
+		while(value % 5 == 0)
+		{
+			value /= 5;
+			++count;
+		}
+		return count;
+	}
+
+	inline bool MultipleOfPow5(uint32_t value, uint32_t p)
+	{
+		return Pow5Factor(value) >= p;
+	}
+
+	inline bool MultipleOfPow2(uint32_t value, uint32_t p)
+	{
+		return (value & ((1u << p) - 1)) == 0;
+	}
+
+	// (m * factor) >> shift, for shift > 32, without a 128-bit product
+	inline uint32_t MulShift(uint32_t m, uint64_t factor, int shift)
+	{
+		uint64_t low = static_cast<uint64_t>(m) * static_cast<uint32_t>(factor);
+		uint64_t high = static_cast<uint64_t>(m) * static_cast<uint32_t>(factor >> 32);
+		uint64_t sum = (low >> 32) + high;
+		return static_cast<uint32_t>(sum >> (shift - 32));
+	}
+
+	inline uint32_t MulPow5InverseDivPow2(uint32_t m, uint32_t q, int j)
+	{
+		return MulShift(m, Pow5InverseSplit[q], j);
+	}
+
+	inline uint32_t MulPow5DivPow2(uint32_t m, uint32_t i, int j)
+	{
+		return MulShift(m, Pow5Split[i], j);
+	}
+
+
+	// A finite, nonzero float as Digits * 10^Exponent
+	struct DecimalReal
+	{
+		uint32_t Digits;
+		int Exponent;
+	};
+
+	DecimalReal ShortestDecimal(uint32_t ieeemantissa, uint32_t ieeeexponent)
+	{
+		int e2;
+		uint32_t m2;
+		if(ieeeexponent == 0)
+		{
+			e2 = 1 - FloatBias - FloatMantissaBits - 2;
+			m2 = ieeemantissa;
+		}
+		else
+		{
+			e2 = static_cast<int>(ieeeexponent) - FloatBias - FloatMantissaBits - 2;
+			m2 = (1u << FloatMantissaBits) | ieeemantissa;
+		}
+
+		bool acceptbounds = (m2 & 1) == 0;
+
+		// The value and the halfway points below and above it, times
+		// four; the lower gap is half as wide at a power of two
+		uint32_t mv = 4 * m2;
+		uint32_t mp = 4 * m2 + 2;
+		uint32_t mmshift = (ieeemantissa != 0 || ieeeexponent <= 1) ? 1 : 0;
+		uint32_t mm = 4 * m2 - 1 - mmshift;
+
+		uint32_t vr, vp, vm;
+		int e10;
+		bool vmtrailingzeros = false;
+		bool vrtrailingzeros = false;
+		uint32_t lastremoved = 0;
+
+		if(e2 >= 0)
+		{
+			uint32_t q = Log10Pow2(e2);
+			e10 = static_cast<int>(q);
+			int k = Pow5InverseBitCount + Pow5Bits(q) - 1;
+			int i = -e2 + static_cast<int>(q) + k;
+
+			vr = MulPow5InverseDivPow2(mv, q, i);
+			vp = MulPow5InverseDivPow2(mp, q, i);
+			vm = MulPow5InverseDivPow2(mm, q, i);
+
+			if(q != 0 && (vp - 1) / 10 <= vm / 10)
+			{
+				int l = Pow5InverseBitCount + Pow5Bits(q - 1) - 1;
+				lastremoved = MulPow5InverseDivPow2(mv, q - 1, -e2 + static_cast<int>(q) - 1 + l) % 10;
+			}
+
+			if(q <= 9)
+			{
+				if(mv % 5 == 0)
+					vrtrailingzeros = MultipleOfPow5(mv, q);
+				else if(acceptbounds)
+					vmtrailingzeros = MultipleOfPow5(mm, q);
+				else
+					vp -= MultipleOfPow5(mp, q) ? 1 : 0;
+			}
+		}
+		else
+		{
+			uint32_t q = Log10Pow5(-e2);
+			e10 = static_cast<int>(q) + e2;
+			int i = -e2 - static_cast<int>(q);
+			int k = Pow5Bits(i) - Pow5BitCount;
+			int j = static_cast<int>(q) - k;
+
+			vr = MulPow5DivPow2(mv, i, j);
+			vp = MulPow5DivPow2(mp, i, j);
+			vm = MulPow5DivPow2(mm, i, j);
+
+			if(q != 0 && (vp - 1) / 10 <= vm / 10)
+			{
+				j = static_cast<int>(q) - 1 - (Pow5Bits(i + 1) - Pow5BitCount);
+				lastremoved = MulPow5DivPow2(mv, i + 1, j) % 10;
+			}
+
+			if(q <= 1)
+			{
+				vrtrailingzeros = true;
+				if(acceptbounds)
+					vmtrailingzeros = (mmshift == 1);
+				else
+					--vp;
+			}
+			else if(q < 31)
+			{
+				vrtrailingzeros = MultipleOfPow2(mv, q - 1);
+			}
+		}
+
+		int removed = 0;
+		uint32_t output;
+		if(vmtrailingzeros || vrtrailingzeros)
+		{
+			while(vp / 10 > vm / 10)
+			{
+				vmtrailingzeros &= (vm % 10 == 0);
+				vrtrailingzeros &= (lastremoved == 0);
+				lastremoved = vr % 10;
+				vr /= 10;
+				vp /= 10;
+				vm /= 10;
+				++removed;
+			}
+
+			if(vmtrailingzeros)
+			{
+				while(vm % 10 == 0)
+				{
+					vrtrailingzeros &= (lastremoved == 0);
+					lastremoved = vr % 10;
+					vr /= 10;
+					vp /= 10;
+					vm /= 10;
+					++removed;
+				}
+			}
+
+			// Exactly halfway between two candidates rounds to even
+			if(vrtrailingzeros && lastremoved == 5 && vr % 2 == 0)
+				lastremoved = 4;
+
+			output = vr + (((vr == vm && (!acceptbounds || !vmtrailingzeros)) || lastremoved >= 5) ? 1 : 0);
+		}
+		else
+		{
+			while(vp / 10 > vm / 10)
+			{
+				lastremoved = vr % 10;
+				vr /= 10;
+				vp /= 10;
+				vm /= 10;
+				++removed;
+			}
+
+			output = vr + ((vr == vm || lastremoved >= 5) ? 1 : 0);
+		}
+
+		DecimalReal decimal;
+		decimal.Digits = output;
+		decimal.Exponent = e10 + removed;
+		return decimal;
+	}
+
+
+	//
+	// Lay out Digits * 10^Exponent much as %g would: fixed notation
+	// while the leading digit is between 10^-4 and 10^8, scientific
+	// with at least two exponent digits outside that.
+	//
+	size_t WriteDecimal(char* out, const DecimalReal& decimal)
+	{
+		char digits[NumberFormat::MaxIntegerChars];
+		int count = static_cast<int>(FormatDigits(digits, decimal.Digits));
+		int leading = decimal.Exponent + count - 1;
+
+		char* p = out;
+		if(leading >= -4 && leading < 9)
+		{
+			if(decimal.Exponent >= 0)
+			{
+				memcpy(p, digits, count);
+				p += count;
+				memset(p, '0', decimal.Exponent);
+				p += decimal.Exponent;
+			}
+			else if(leading >= 0)
+			{
+				memcpy(p, digits, leading + 1);
+				p += leading + 1;
+				*p++ = '.';
+				memcpy(p, digits + leading + 1, count - leading - 1);
+				p += count - leading - 1;
+			}
+			else
+			{
+				*p++ = '0';
+				*p++ = '.';
+				memset(p, '0', -leading - 1);
+				p += -leading - 1;
+				memcpy(p, digits, count);
+				p += count;
+			}
+		}
+		else
+		{
+			*p++ = digits[0];
+			if(count > 1)
+			{
+				*p++ = '.';
+				memcpy(p, digits + 1, count - 1);
+				p += count - 1;
+			}
+
+			*p++ = 'e';
+			*p++ = leading < 0 ? '-' : '+';
+
+			unsigned magnitude = static_cast<unsigned>(leading < 0 ? -leading : leading);
+			if(magnitude < 10)
+				*p++ = '0';
+			p += FormatDigits(p, magnitude);
+		}
+
+		return static_cast<size_t>(p - out);
+	}
+
+
+	//
+	// Case insensitive match of a lowercase word at the start of a range
+	//
+	bool MatchWord(const char* s, size_t length, const char* word)
+	{
+		size_t wordlength = strlen(word);
+		if(length < wordlength)
+			return false;
+
+		for(size_t i = 0; i < wordlength; ++i)
+		{
+			if((s[i] | 0x20) != word[i])
+				return false;
+		}
+
+		return true;
+	}
+
+	//
+	// Powers of ten that doubles hold exactly, so that one multiply or
+	// divide by them rounds correctly
+	//
+	const double ExactPowersOfTen[] =
+	{
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	const int MaxExactPowerOfTen = 22;
+
+	//
+	// Narrowing a correctly rounded double to float can only round the
+	// wrong way when the double landed exactly halfway between two
+	// floats, which can be tested for directly.
+	//
+	bool NarrowsCorrectly(double d)
+	{
+		float f = static_cast<float>(d);
+		if(static_cast<double>(f) == d)
+			return true;
+
+		if(std::fabs(d) > std::numeric_limits<float>::max())
+			return false;
+
+		float other = std::nextafter(f, d > f ? std::numeric_limits<float>::infinity() : -std::numeric_limits<float>::infinity());
+		return (static_cast<double>(f) + static_cast<double>(other)) / 2.0 != d;
+	}
+
+	//
+	// Slow but exact conversion of a scanned number, for when the
+	// quick one cannot promise correct rounding
+	//
+	float ParseRealExactly(const char* s, size_t length)
+	{
+		char buffer[64];
+		if(length < sizeof(buffer))
+		{
+			memcpy(buffer, s, length);
+			buffer[length] = 0;
+			return strtof(buffer, nullptr);
+		}
+
+		std::string copy(s, length);
+		return strtof(copy.c_str(), nullptr);
+	}
+
+}
+
+
+
+size_t NumberFormat::FormatInteger(char* out, int64_t value)
+{
+	if(value >= 0)
+	{
+		if(value <= std::numeric_limits<uint32_t>::max())
+			return FormatDigits(out, static_cast<uint32_t>(value));
+
+		return FormatDigits(out, static_cast<uint64_t>(value));
+	}
+
+	// Negate as unsigned, which also copes with the most negative value
+	uint64_t magnitude = 0 - static_cast<uint64_t>(value);
+
+	*out = '-';
+	if(magnitude <= std::numeric_limits<uint32_t>::max())
+		return 1 + FormatDigits(out + 1, static_cast<uint32_t>(magnitude));
+
+	return 1 + FormatDigits(out + 1, magnitude);
+}
+
+size_t NumberFormat::FormatReal(char* out, float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	uint32_t ieeemantissa = bits & ((1u << FloatMantissaBits) - 1);
+	uint32_t ieeeexponent = (bits >> FloatMantissaBits) & ((1u << FloatExponentBits) - 1);
+	bool negative = (bits >> 31) != 0;
+
+	if(ieeeexponent == (1u << FloatExponentBits) - 1)
+	{
+		if(ieeemantissa)
+		{
+			memcpy(out, "nan", 3);
+			return 3;
+		}
+
+		if(negative)
+		{
+			memcpy(out, "-inf", 4);
+			return 4;
+		}
+
+		memcpy(out, "inf", 3);
+		return 3;
+	}
+
+	char* p = out;
+	if(negative)
+		*p++ = '-';
+
+	if(ieeeexponent == 0 && ieeemantissa == 0)
+	{
+		*p++ = '0';
+		return static_cast<size_t>(p - out);
+	}
+
+	return static_cast<size_t>(p - out) + WriteDecimal(p, ShortestDecimal(ieeemantissa, ieeeexponent));
+}
+
+
+size_t NumberFormat::ParseInteger(const char* s, size_t length, int64_t minvalue, int64_t maxvalue, int64_t& value)
+{
+	size_t pos = 0;
+	bool negative = false;
+	if(pos < length && (s[pos] == '-' || s[pos] == '+'))
+	{
+		negative = (s[pos] == '-');
+		++pos;
+	}
+
+	size_t digitsstart = pos;
+	uint64_t magnitude = 0;
+	bool overflow = false;
+	while(pos < length && unsigned(s[pos] - '0') < 10)
+	{
+		unsigned digit = unsigned(s[pos] - '0');
+		if(magnitude > (std::numeric_limits<uint64_t>::max() - digit) / 10)
+			overflow = true;
+		else
+			magnitude = magnitude * 10 + digit;
+
+		++pos;
+	}
+
+	if(pos == digitsstart)
+		return 0;
+
+	if(negative)
+	{
+		uint64_t limit = static_cast<uint64_t>(-(minvalue + 1)) + 1;
+		if(overflow || magnitude >= limit)
+			value = minvalue;
+		else
+			value = -static_cast<int64_t>(magnitude);
+	}
+	else
+	{
+		if(overflow || magnitude > static_cast<uint64_t>(maxvalue))
+			value = maxvalue;
+		else
+			value = static_cast<int64_t>(magnitude);
+	}
+
+	return pos;
+}
+
+//
+// Up to 19 significant digits are gathered into an integer. When that
+// and the power of ten both fit a double exactly, one multiply or
+// divide gives the answer; anything else goes to strtof.
+//
+size_t NumberFormat::ParseReal(const char* s, size_t length, float& value)
+{
+	size_t pos = 0;
+	bool negative = false;
+	if(pos < length && (s[pos] == '-' || s[pos] == '+'))
+	{
+		negative = (s[pos] == '-');
+		++pos;
+	}
+
+	if(pos < length && unsigned(s[pos] - '0') >= 10 && s[pos] != '.')
+	{
+		float special;
+		size_t wordlength;
+		if(MatchWord(s + pos, length - pos, "infinity"))
+		{
+			special = std::numeric_limits<float>::infinity();
+			wordlength = 8;
+		}
+		else if(MatchWord(s + pos, length - pos, "inf"))
+		{
+			special = std::numeric_limits<float>::infinity();
+			wordlength = 3;
+		}
+		else if(MatchWord(s + pos, length - pos, "nan"))
+		{
+			special = std::numeric_limits<float>::quiet_NaN();
+			wordlength = 3;
+		}
+		else
+		{
+			return 0;
+		}
+
+		value = negative ? -special : special;
+		return pos + wordlength;
+	}
+
+	const int MaxSignificantDigits = 19;
+
+	uint64_t mantissa = 0;
+	int significant = 0;
+	int exponent = 0;
+	bool truncated = false;
+	bool anydigits = false;
+
+	while(pos < length && unsigned(s[pos] - '0') < 10)
+	{
+		unsigned digit = unsigned(s[pos] - '0');
+		if(mantissa == 0 && digit == 0)
+		{
+		}
+		else if(significant < MaxSignificantDigits)
+		{
+			mantissa = mantissa * 10 + digit;
+			++significant;
+		}
+		else
+		{
+			++exponent;
+			truncated |= (digit != 0);
+		}
+
+		anydigits = true;
+		++pos;
+	}
+
+	if(pos < length && s[pos] == '.')
+	{
+		++pos;
+		while(pos < length && unsigned(s[pos] - '0') < 10)
+		{
+			unsigned digit = unsigned(s[pos] - '0');
+			if(mantissa == 0 && digit == 0)
+			{
+				--exponent;
+			}
+			else if(significant < MaxSignificantDigits)
+			{
+				mantissa = mantissa * 10 + digit;
+				++significant;
+				--exponent;
+			}
+			else
+			{
+				truncated |= (digit != 0);
+			}
+
+			anydigits = true;
+			++pos;
+		}
+	}
+
+	if(!anydigits)
+		return 0;
+
+	// An exponent marker only counts if digits follow it
+	if(pos < length && (s[pos] == 'e' || s[pos] == 'E'))
+	{
+		size_t epos = pos + 1;
+		bool enegative = false;
+		if(epos < length && (s[epos] == '-' || s[epos] == '+'))
+		{
+			enegative = (s[epos] == '-');
+			++epos;
+		}
+
+		if(epos < length && unsigned(s[epos] - '0') < 10)
+		{
+			int written = 0;
+			while(epos < length && unsigned(s[epos] - '0') < 10)
+			{
+				if(written < 100000)
+					written = written * 10 + int(s[epos] - '0');
+				++epos;
+			}
+
+			exponent += enegative ? -written : written;
+			pos = epos;
+		}
+	}
+
+	if(mantissa == 0)
+	{
+		value = negative ? -0.0f : 0.0f;
+		return pos;
+	}
+
+	if(!truncated && mantissa <= (uint64_t(1) << 53) && exponent >= -MaxExactPowerOfTen && exponent <= MaxExactPowerOfTen)
+	{
+		double d = static_cast<double>(mantissa);
+		if(exponent < 0)
+			d /= ExactPowersOfTen[-exponent];
+		else
+			d *= ExactPowersOfTen[exponent];
+
+		if(NarrowsCorrectly(d))
+		{
+			float f = static_cast<float>(d);
+			value = negative ? -f : f;
+			return pos;
+		}
+	}
+
+	value = ParseRealExactly(s, pos);
+	return pos;
+}
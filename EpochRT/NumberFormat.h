@@ -0,0 +1,33 @@
+#pragma once
+
+
+//
+// Conversions between numbers and their text, in the manner of
+// std::to_chars and std::from_chars
+//
+// Formatting writes into a caller's buffer of at least the given
+// maximum size and returns the number of characters written; there
+// is no null terminator, locale, or heap allocation involved. Reals
+// are written with the fewest digits that read back as the same
+// float, in fixed notation for moderate magnitudes and scientific
+// notation (1.5e+20) otherwise.
+//
+// Parsing reads an optional sign and then as much of a number as it
+// can from the start of the range, returning the number of characters
+// used, or zero if there was no number there at all. Integers out of
+// range are clamped to the nearest representable value. Reals are
+// rounded correctly, and inf, infinity and nan are accepted in any
+// case, as written by formatting.
+//
+namespace NumberFormat
+{
+	const size_t MaxIntegerChars = 20;
+	const size_t MaxRealChars = 16;
+
+	size_t FormatInteger(char* out, int64_t value);
+	size_t FormatReal(char* out, float value);
+
+	size_t ParseInteger(const char* s, size_t length, int64_t minvalue, int64_t maxvalue, int64_t& value);
+	size_t ParseReal(const char* s, size_t length, float& value);
+}
+
@@ -0,0 +1,62 @@
+#include "stdafx.h"
+#include "Nursery.h"
+#include "HeapMap.h"
+
+
+
+//
+// The region is reserved and committed up front, but pages are
+// only backed by physical memory once the bump pointer reaches
+// them, so idle threads cost address space rather than RAM.
+//
+Nursery::Nursery()
+{
+	Base = reinterpret_cast<char*>(::VirtualAlloc(nullptr, Size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+	assert(Base);
+
+	Top = Base;
+	End = Base + Size;
+
+	HeapMap::Register(Base, Size);
+}
+
+Nursery::~Nursery()
+{
+	HeapMap::Unregister(Base, Size);
+	::VirtualFree(Base, 0, MEM_RELEASE);
+}
+
+
+//
+// Returns null once the region is full. The caller is expected to
+// fall back to the mature pool until the next collection empties
+// the nursery again.
+//
+StringHeader* Nursery::Alloc(size_t blocksize)
+{
+	size_t rounded = (blocksize + Alignment - 1) & ~(Alignment - 1);
+	if(static_cast<size_t>(End - Top) < rounded)
+		return nullptr;
+
+	StringHeader* header = reinterpret_cast<StringHeader*>(Top);
+	Top += rounded;
+	return header;
+}
+
+void Nursery::Reset()
+{
+	Top = Base;
+}
+
+//
+// Let the OS reclaim the physical pages behind an empty nursery.
+// They stay committed, but their contents are undefined from here
+// on: they may read back as zeroes or as the old data. Every block
+// allocated from the nursery is written in full before use.
+//
+void Nursery::Trim()
+{
+	assert(Top == Base);
+	::VirtualAlloc(Base, Size, MEM_RESET, PAGE_READWRITE);
+}
+
@@ -0,0 +1,53 @@
+#pragma once
+
+
+#include "StringHeader.h"
+
+
+//
+// Bump-pointer allocation area for young strings
+//
+// Most strings produced at runtime (concatenations, substrings,
+// number conversions) are garbage almost as soon as they are
+// made. They are carved out of this region by bumping a pointer,
+// and a minor collection copies the few that are still referenced
+// into the mature pool, after which the whole region is reused
+// from the start without ever being swept.
+//
+class Nursery
+{
+public:
+	Nursery();
+	~Nursery();
+
+	Nursery(const Nursery&) = delete;
+	Nursery& operator = (const Nursery&) = delete;
+
+public:
+	StringHeader* Alloc(size_t blocksize);
+	void Reset();
+	void Trim();
+
+	// Checks the whole reserved region rather than the used part,
+	// so other threads can ask without racing on the bump pointer
+	bool Contains(const void* p) const
+	{
+		return (p >= Base) && (p < End);
+	}
+
+	size_t GetUsedBytes() const
+	{
+		return static_cast<size_t>(Top - Base);
+	}
+
+public:
+	static const size_t Size = 1024 * 1024;
+	static const size_t MaxBlockSize = 1024;
+	static const size_t Alignment = 8;
+
+private:
+	char* Base;
+	char* Top;
+	char* End;
+};
+
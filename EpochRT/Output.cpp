@@ -0,0 +1,184 @@
+#include "stdafx.h"
+#include "Output.h"
+
+
+#include <mutex>
+
+
+
+namespace
+{
+
+	// Lines end the way the C runtime's text mode would end them
+	const char LineEnd[] = "\r\n";
+	const size_t LineEndLength = sizeof(LineEnd) - 1;
+
+
+	class StreamBuffer
+	{
+	public:
+		explicit StreamBuffer(DWORD handleid)
+			: HandleID(handleid),
+			  Handle(nullptr),
+			  LineBuffered(false),
+			  Used(0)
+		{
+		}
+
+		StreamBuffer(const StreamBuffer&) = delete;
+		StreamBuffer& operator = (const StreamBuffer&) = delete;
+
+	public:
+		void Write(const char* chars, size_t length, bool endline)
+		{
+			std::lock_guard<std::mutex> lock(Mutex);
+
+			if(!Handle)
+				Open();
+
+			size_t needed = length + (endline ? LineEndLength : 0);
+			if(Used + needed > Capacity)
+			{
+				FlushLocked();
+
+				if(needed > Capacity)
+				{
+					WriteOut(chars, length);
+					length = 0;
+				}
+			}
+
+			memcpy(Data + Used, chars, length);
+			Used += length;
+
+			if(endline)
+			{
+				memcpy(Data + Used, LineEnd, LineEndLength);
+				Used += LineEndLength;
+
+				if(LineBuffered)
+					FlushLocked();
+			}
+		}
+
+		void Flush()
+		{
+			std::lock_guard<std::mutex> lock(Mutex);
+			FlushLocked();
+		}
+
+		//
+		// For when the process is going away; other threads may have
+		// been killed while holding the lock, so it is not taken.
+		//
+		void FlushWithoutLocking()
+		{
+			FlushLocked();
+		}
+
+	public:
+		static const size_t Capacity = 64 * 1024;
+
+	private:
+		//
+		// Deferred until the first write, since a console or a
+		// redirection may have been set up after the runtime loaded
+		//
+		void Open()
+		{
+			Handle = ::GetStdHandle(HandleID);
+
+			const char* setting = getenv("EPOCH_OUTPUT_BUFFERING");
+			if(setting && strcmp(setting, "line") == 0)
+				LineBuffered = true;
+			else if(setting && strcmp(setting, "full") == 0)
+				LineBuffered = false;
+			else
+				LineBuffered = (::GetFileType(Handle) == FILE_TYPE_CHAR);
+		}
+
+		void FlushLocked()
+		{
+			if(Used == 0)
+				return;
+
+			WriteOut(Data, Used);
+			Used = 0;
+		}
+
+		//
+		// Failures are dropped, as they would be by std::cout; there is
+		// nobody to tell when the output itself is broken.
+		//
+		void WriteOut(const char* chars, size_t length)
+		{
+			if(!Handle || Handle == INVALID_HANDLE_VALUE)
+				return;
+
+			while(length > 0)
+			{
+				DWORD chunk = static_cast<DWORD>(std::min<size_t>(length, 0x40000000));
+				DWORD written = 0;
+				if(!::WriteFile(Handle, chars, chunk, &written, nullptr) || written == 0)
+					return;
+
+				chars += written;
+				length -= written;
+			}
+		}
+
+	private:
+		DWORD HandleID;
+		HANDLE Handle;
+		bool LineBuffered;
+
+		std::mutex Mutex;
+		size_t Used;
+		char Data[Capacity];
+	};
+
+
+	StreamBuffer StandardOutputBuffer(STD_OUTPUT_HANDLE);
+	StreamBuffer StandardErrorBuffer(STD_ERROR_HANDLE);
+
+	StreamBuffer* const Streams[Output::StreamCount] =
+	{
+		&StandardOutputBuffer,
+		&StandardErrorBuffer
+	};
+
+}
+
+
+
+void Output::Write(Stream stream, const char* chars, size_t length)
+{
+	Streams[stream]->Write(chars, length, false);
+}
+
+void Output::WriteLine(Stream stream, const char* chars, size_t length)
+{
+	Streams[stream]->Write(chars, length, true);
+}
+
+
+void Output::Flush(Stream stream)
+{
+	Streams[stream]->Flush();
+}
+
+void Output::FlushAll()
+{
+	for(StreamBuffer* stream : Streams)
+		stream->Flush();
+}
+
+//
+// Called from DllMain as the process exits
+//
+void Output::Shutdown()
+{
+	for(StreamBuffer* stream : Streams)
+		stream->FlushWithoutLocking();
+}
+
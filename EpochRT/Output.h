@@ -0,0 +1,36 @@
+#pragma once
+
+
+//
+// Buffered standard output and error, for print and the test harness
+//
+// Each stream gathers what is written to it in a buffer of its own,
+// which goes out in a single write when it fills, when ERT_flush is
+// called, before a failed assertion ends the process, and when the
+// runtime unloads. A stream attached to a console is also flushed at
+// the end of every line, so that output meant for a person shows up
+// as it is printed; redirected to a file or a pipe, lines are left to
+// accumulate. EPOCH_OUTPUT_BUFFERING=line or full overrides that
+// choice for both streams.
+//
+// Text too long for the buffer is written straight after whatever
+// was already buffered, without being copied.
+//
+namespace Output
+{
+	enum Stream
+	{
+		StandardOutput,
+		StandardError,
+		StreamCount
+	};
+
+	void Write(Stream stream, const char* chars, size_t length);
+	void WriteLine(Stream stream, const char* chars, size_t length);
+
+	void Flush(Stream stream);
+	void FlushAll();
+
+	void Shutdown();
+}
+
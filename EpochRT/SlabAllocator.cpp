@@ -0,0 +1,412 @@
+#include "stdafx.h"
+#include "SlabAllocator.h"
+#include "HeapMap.h"
+
+
+
+SlabAllocator::SlabAllocator()
+	: EvacuatingChunks(nullptr),
+	  LiveBytes(0),
+	  Sweeping(false),
+	  SweepSizeClass(NumSizeClasses),
+	  SweepChunk(nullptr),
+	  SweepSlot(0)
+{
+	for(unsigned i = 0; i < NumSizeClasses; ++i)
+	{
+		Chunks[i] = nullptr;
+		Current[i] = nullptr;
+	}
+}
+
+SlabAllocator::~SlabAllocator()
+{
+	for(unsigned i = 0; i < NumSizeClasses; ++i)
+	{
+		Chunk* chunk = Chunks[i];
+		while(chunk)
+		{
+			Chunk* next = chunk->Next;
+			ReleaseChunk(chunk);
+			chunk = next;
+		}
+	}
+
+	FinishEvacuation();
+
+	for(auto& entry : LargeBlocks)
+		free(entry.first);
+}
+
+
+unsigned SlabAllocator::GetSizeClass(size_t blocksize)
+{
+	unsigned sizeclass = 0;
+	size_t slotsize = MinSlotSize;
+	while(slotsize < blocksize)
+	{
+		slotsize <<= 1;
+		++sizeclass;
+	}
+
+	return sizeclass;
+}
+
+
+//
+// Allocate storage for a block of the given total size, header
+// included. The header is left for the caller to fill in.
+//
+StringHeader* SlabAllocator::Alloc(size_t blocksize)
+{
+	if(blocksize > MaxSlotSize)
+	{
+		StringHeader* header = reinterpret_cast<StringHeader*>(malloc(blocksize));
+		LargeBlocks.emplace(header, blocksize);
+		LiveBytes += blocksize;
+		return header;
+	}
+
+	unsigned sizeclass = GetSizeClass(blocksize);
+
+	Chunk* chunk = Current[sizeclass];
+	while(chunk && !chunk->FreeList && chunk->BumpIndex == chunk->SlotCount)
+		chunk = chunk->Next;
+
+	if(!chunk)
+		chunk = AllocChunk(sizeclass);
+
+	Current[sizeclass] = chunk;
+
+	char* slot;
+	if(chunk->FreeList)
+	{
+		FreeSlot* freeslot = chunk->FreeList;
+		chunk->FreeList = freeslot->Next;
+		slot = reinterpret_cast<char*>(freeslot) - sizeof(StringHeader);
+	}
+	else
+	{
+		slot = chunk->FirstSlot() + chunk->BumpIndex * chunk->SlotSize;
+		++chunk->BumpIndex;
+	}
+
+	++chunk->LiveCount;
+	LiveBytes += chunk->SlotSize;
+	return reinterpret_cast<StringHeader*>(slot);
+}
+
+void SlabAllocator::Free(StringHeader* header)
+{
+	Chunk* chunk = FindChunk(header);
+	if(chunk)
+	{
+		FreeToChunk(chunk, header);
+		ReleaseEmptyChunks(chunk->SizeClass);
+		Current[chunk->SizeClass] = Chunks[chunk->SizeClass];
+	}
+	else
+	{
+		auto iter = LargeBlocks.find(header);
+		LiveBytes -= iter->second;
+		LargeBlocks.erase(iter);
+		free(header);
+	}
+}
+
+
+//
+// Check that a header address is the start of a live block
+// handed out by this allocator. Anything else (static strings,
+// memory returned by external C functions, interior pointers)
+// is rejected.
+//
+bool SlabAllocator::Owns(const StringHeader* header) const
+{
+	Chunk* chunk = FindChunk(header);
+	if(!chunk)
+		return LargeBlocks.count(const_cast<StringHeader*>(header)) != 0;
+
+	const char* p = reinterpret_cast<const char*>(header);
+	const char* first = chunk->FirstSlot();
+	if(p < first)
+		return false;
+
+	size_t offset = static_cast<size_t>(p - first);
+	if(offset % chunk->SlotSize)
+		return false;
+
+	if(offset / chunk->SlotSize >= chunk->BumpIndex)
+		return false;
+
+	return header->Owner != nullptr;
+}
+
+//
+// Keep the block's chunk where it is for good. Used for strings
+// whose address has escaped to native code; large blocks never
+// move in the first place.
+//
+void SlabAllocator::Pin(const StringHeader* header)
+{
+	Chunk* chunk = FindChunk(header);
+	if(chunk)
+		chunk->Pinned = 1;
+}
+
+//
+// Let every chunk move again. The collector re-pins the chunks that
+// still hold pinned strings before it picks any to evacuate.
+//
+void SlabAllocator::ClearPins()
+{
+	for(unsigned sizeclass = 0; sizeclass < NumSizeClasses; ++sizeclass)
+	{
+		for(Chunk* chunk = Chunks[sizeclass]; chunk; chunk = chunk->Next)
+			chunk->Pinned = 0;
+	}
+}
+
+
+size_t SlabAllocator::GetCommittedBytes() const
+{
+	size_t bytes = ChunkSet.size() * ChunkSize;
+	for(auto& entry : LargeBlocks)
+		bytes += entry.second;
+
+	return bytes;
+}
+
+
+//
+// Give back the empty chunk that each size class normally keeps in
+// reserve. Returns the number of chunks released.
+//
+size_t SlabAllocator::Trim()
+{
+	assert(!Sweeping);
+
+	size_t released = 0;
+	for(unsigned sizeclass = 0; sizeclass < NumSizeClasses; ++sizeclass)
+	{
+		released += ReleaseEmptyChunks(sizeclass, false);
+		Current[sizeclass] = Chunks[sizeclass];
+	}
+
+	return released;
+}
+
+
+void SlabAllocator::BeginSweep()
+{
+	Sweeping = true;
+	SweepSizeClass = 0;
+	SweepChunk = Chunks[0];
+	SweepSlot = 0;
+}
+
+
+bool SlabAllocator::IsEmpty() const
+{
+	for(unsigned sizeclass = 0; sizeclass < NumSizeClasses; ++sizeclass)
+	{
+		for(const Chunk* chunk = Chunks[sizeclass]; chunk; chunk = chunk->Next)
+		{
+			if(chunk->LiveCount)
+				return false;
+		}
+	}
+
+	return LargeBlocks.empty();
+}
+
+
+SlabAllocator::Chunk* SlabAllocator::FindChunk(const void* p) const
+{
+	uintptr_t base = reinterpret_cast<uintptr_t>(p) & ~(uintptr_t(ChunkSize) - 1);
+	const Chunk* chunk = reinterpret_cast<const Chunk*>(base);
+
+	if(!ChunkSet.count(chunk))
+		return nullptr;
+
+	return const_cast<Chunk*>(chunk);
+}
+
+
+//
+// Chunks come straight from VirtualAlloc, whose allocation
+// granularity (64KB) matches our chunk size and so gives us
+// the alignment that FindChunk relies on.
+//
+SlabAllocator::Chunk* SlabAllocator::AllocChunk(unsigned sizeclass)
+{
+	void* mem = ::VirtualAlloc(nullptr, ChunkSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	assert(mem && (reinterpret_cast<uintptr_t>(mem) & (ChunkSize - 1)) == 0);
+
+	Chunk* chunk = reinterpret_cast<Chunk*>(mem);
+	chunk->FreeList = nullptr;
+	chunk->SizeClass = sizeclass;
+	chunk->SlotSize = static_cast<uint32_t>(MinSlotSize << sizeclass);
+	chunk->SlotCount = static_cast<uint32_t>((ChunkSize - SlotOffset) / chunk->SlotSize);
+	chunk->BumpIndex = 0;
+	chunk->LiveCount = 0;
+	chunk->Pinned = 0;
+	chunk->Evacuating = 0;
+
+	chunk->Next = Chunks[sizeclass];
+	Chunks[sizeclass] = chunk;
+
+	ChunkSet.insert(chunk);
+	HeapMap::Register(chunk, ChunkSize);
+	return chunk;
+}
+
+void SlabAllocator::ReleaseChunk(Chunk* chunk)
+{
+	ChunkSet.erase(chunk);
+	HeapMap::Unregister(chunk, ChunkSize);
+	::VirtualFree(chunk, 0, MEM_RELEASE);
+}
+
+
+//
+// Pick out the chunks to evacuate and take them off the allocation
+// lists, so that the blocks copied out of them land elsewhere. In
+// each size class the chunks below the occupancy limit are chosen,
+// as long as moving their blocks frees up at least one chunk
+// overall, counting the room left in the chunks that stay.
+//
+// Must not be called while a sweep is in progress. Returns the
+// number of chunks chosen.
+//
+size_t SlabAllocator::BeginEvacuation(unsigned maxoccupancypercent)
+{
+	assert(!Sweeping);
+
+	size_t chosen = 0;
+	for(unsigned sizeclass = 0; sizeclass < NumSizeClasses; ++sizeclass)
+	{
+		auto issparse = [maxoccupancypercent](const Chunk* chunk) {
+			return !chunk->Pinned && chunk->LiveCount && (uint64_t(chunk->LiveCount) * 100 < uint64_t(chunk->SlotCount) * maxoccupancypercent);
+		};
+
+		size_t candidates = 0;
+		size_t liveslots = 0;
+		size_t spareslots = 0;
+		size_t slotsperchunk = 0;
+
+		for(const Chunk* chunk = Chunks[sizeclass]; chunk; chunk = chunk->Next)
+		{
+			slotsperchunk = chunk->SlotCount;
+
+			if(issparse(chunk))
+			{
+				++candidates;
+				liveslots += chunk->LiveCount;
+			}
+			else
+				spareslots += chunk->SlotCount - chunk->LiveCount;
+		}
+
+		if(!candidates)
+			continue;
+
+		size_t overflow = (liveslots > spareslots) ? (liveslots - spareslots) : 0;
+		size_t newchunks = (overflow + slotsperchunk - 1) / slotsperchunk;
+		if(newchunks >= candidates)
+			continue;
+
+		Chunk** link = &Chunks[sizeclass];
+		while(*link)
+		{
+			Chunk* chunk = *link;
+			if(issparse(chunk))
+			{
+				*link = chunk->Next;
+
+				chunk->Evacuating = 1;
+				chunk->Next = EvacuatingChunks;
+				EvacuatingChunks = chunk;
+				++chosen;
+			}
+			else
+				link = &chunk->Next;
+		}
+
+		Current[sizeclass] = Chunks[sizeclass];
+	}
+
+	return chosen;
+}
+
+bool SlabAllocator::IsEvacuating(const void* p) const
+{
+	Chunk* chunk = FindChunk(p);
+	return chunk && chunk->Evacuating;
+}
+
+//
+// Release the evacuated chunks, once nothing refers to them any
+// more. Returns the number of chunks released.
+//
+size_t SlabAllocator::FinishEvacuation()
+{
+	size_t released = 0;
+
+	while(EvacuatingChunks)
+	{
+		Chunk* chunk = EvacuatingChunks;
+		EvacuatingChunks = chunk->Next;
+
+		LiveBytes -= chunk->LiveCount * chunk->SlotSize;
+		ReleaseChunk(chunk);
+		++released;
+	}
+
+	return released;
+}
+
+
+//
+// Freed slots keep their header (with a null Owner, so sweeps
+// and Owns() can tell them apart) and thread the free list
+// through the character data that follows it.
+//
+void SlabAllocator::FreeToChunk(Chunk* chunk, StringHeader* header)
+{
+	header->Owner = nullptr;
+
+	FreeSlot* freeslot = reinterpret_cast<FreeSlot*>(header + 1);
+	freeslot->Next = chunk->FreeList;
+	chunk->FreeList = freeslot;
+
+	--chunk->LiveCount;
+	LiveBytes -= chunk->SlotSize;
+}
+
+size_t SlabAllocator::ReleaseEmptyChunks(unsigned sizeclass, bool keepone)
+{
+	Chunk** link = &Chunks[sizeclass];
+	bool keptone = !keepone;
+	size_t released = 0;
+
+	while(*link)
+	{
+		Chunk* chunk = *link;
+		if(chunk->LiveCount == 0 && keptone)
+		{
+			*link = chunk->Next;
+			ReleaseChunk(chunk);
+			++released;
+			continue;
+		}
+
+		if(chunk->LiveCount == 0)
+			keptone = true;
+
+		link = &chunk->Next;
+	}
+
+	return released;
+}
+
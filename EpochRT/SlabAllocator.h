@@ -0,0 +1,286 @@
+#pragma once
+
+
+#include "StringHeader.h"
+
+
+#include <unordered_map>
+
+
+//
+// Backing storage for pooled string blocks
+//
+// Small blocks are carved out of fixed-size chunks, one chunk
+// per power-of-two size class, so that strings sit densely in
+// memory and a freed block simply goes back on its chunk's free
+// list. Blocks too big for the largest size class are allocated
+// individually from the C heap, where the heap map cannot see them.
+// Strings that size go to the large object space instead, so only
+// structures, which are only ever looked up through Owns(), end up
+// here.
+//
+// Chunks are aligned to their own size, which lets us map any
+// string pointer back to its chunk without a search. That same
+// mapping is used to reject pointers we never handed out.
+//
+// Long-running programs can leave many chunks with only a few
+// live blocks each. Evacuation copies those blocks into the
+// better-occupied chunks so that the sparse ones can be released;
+// the caller is responsible for redirecting references to the
+// moved blocks before the old chunks go away.
+//
+class SlabAllocator
+{
+public:
+	SlabAllocator();
+	~SlabAllocator();
+
+	SlabAllocator(const SlabAllocator&) = delete;
+	SlabAllocator& operator = (const SlabAllocator&) = delete;
+
+public:
+	StringHeader* Alloc(size_t blocksize);
+	void Free(StringHeader* header);
+
+	bool Owns(const StringHeader* header) const;
+	bool IsEmpty() const;
+
+	void Pin(const StringHeader* header);
+	void ClearPins();
+
+	size_t GetLiveBytes() const
+	{
+		return LiveBytes;
+	}
+
+	size_t GetCommittedBytes() const;
+
+	size_t Trim();
+
+	template<typename PredT>
+	size_t Sweep(PredT isgarbage);
+
+	void BeginSweep();
+
+	template<typename PredT>
+	bool SweepSome(PredT isgarbage, size_t& budget, size_t& freed);
+
+	template<typename FuncT>
+	void ForEachBlock(FuncT func);
+
+	bool IsSweeping() const
+	{
+		return Sweeping;
+	}
+
+	size_t BeginEvacuation(unsigned maxoccupancypercent);
+	bool IsEvacuating(const void* p) const;
+
+	template<typename MoveT>
+	size_t Evacuate(MoveT move);
+
+	size_t FinishEvacuation();
+
+public:
+	// Slots run from 32 bytes to 16KB. The biggest classes fit only a
+	// few slots to a chunk, but even three 16KB slots waste far less
+	// than a 64KB mapping of its own for every medium-sized string.
+	static const size_t ChunkSize = 64 * 1024;
+	static const size_t NumSizeClasses = 10;
+	static const size_t MinSlotSize = 32;
+	static const size_t MaxSlotSize = MinSlotSize << (NumSizeClasses - 1);
+
+private:
+	struct FreeSlot
+	{
+		FreeSlot* Next;
+	};
+
+	struct Chunk
+	{
+		Chunk* Next;
+		FreeSlot* FreeList;
+		uint32_t SizeClass;
+		uint32_t SlotSize;
+		uint32_t SlotCount;
+		uint32_t BumpIndex;
+		uint32_t LiveCount;
+		uint32_t Pinned;
+		uint32_t Evacuating;
+
+		char* FirstSlot()
+		{
+			return reinterpret_cast<char*>(this) + SlotOffset;
+		}
+	};
+
+	static const size_t SlotOffset = (sizeof(Chunk) + 15) & ~size_t(15);
+
+private:
+	static unsigned GetSizeClass(size_t blocksize);
+
+	Chunk* AllocChunk(unsigned sizeclass);
+	void ReleaseChunk(Chunk* chunk);
+
+	Chunk* FindChunk(const void* p) const;
+
+	void FreeToChunk(Chunk* chunk, StringHeader* header);
+	size_t ReleaseEmptyChunks(unsigned sizeclass, bool keepone = true);
+
+private:
+	Chunk* Chunks[NumSizeClasses];
+	Chunk* Current[NumSizeClasses];
+	Chunk* EvacuatingChunks;
+
+	std::unordered_set<const Chunk*> ChunkSet;
+	std::unordered_map<StringHeader*, size_t> LargeBlocks;
+
+	size_t LiveBytes;
+
+	bool Sweeping;
+	unsigned SweepSizeClass;
+	Chunk* SweepChunk;
+	uint32_t SweepSlot;
+};
+
+
+
+//
+// Return every block for which the predicate holds to the
+// free lists (or the C heap, for large blocks). Chunks left
+// completely empty are handed back to the OS, except for one
+// per size class to avoid thrashing on the next allocation.
+//
+template<typename PredT>
+size_t SlabAllocator::Sweep(PredT isgarbage)
+{
+	size_t budget = ~size_t(0);
+	size_t freed = 0;
+
+	BeginSweep();
+	SweepSome(isgarbage, budget, freed);
+	return freed;
+}
+
+
+//
+// Call the given function on the header of every live block.
+//
+template<typename FuncT>
+void SlabAllocator::ForEachBlock(FuncT func)
+{
+	for(unsigned sizeclass = 0; sizeclass < NumSizeClasses; ++sizeclass)
+	{
+		for(Chunk* chunk = Chunks[sizeclass]; chunk; chunk = chunk->Next)
+		{
+			char* slot = chunk->FirstSlot();
+			for(uint32_t i = 0; i < chunk->BumpIndex; ++i, slot += chunk->SlotSize)
+			{
+				StringHeader* header = reinterpret_cast<StringHeader*>(slot);
+				if(header->Owner)
+					func(header);
+			}
+		}
+	}
+
+	for(auto& entry : LargeBlocks)
+		func(entry.first);
+}
+
+
+//
+// Copy every live block out of the chunks chosen by
+// BeginEvacuation(). The move function is given the old and new
+// headers, and must copy the block and leave whatever forwarding
+// information the caller needs in the old one.
+//
+template<typename MoveT>
+size_t SlabAllocator::Evacuate(MoveT move)
+{
+	size_t moved = 0;
+
+	for(Chunk* chunk = EvacuatingChunks; chunk; chunk = chunk->Next)
+	{
+		char* slot = chunk->FirstSlot();
+		for(uint32_t i = 0; i < chunk->BumpIndex; ++i, slot += chunk->SlotSize)
+		{
+			StringHeader* from = reinterpret_cast<StringHeader*>(slot);
+			if(!from->Owner)
+				continue;
+
+			move(from, Alloc(chunk->SlotSize));
+			++moved;
+		}
+	}
+
+	return moved;
+}
+
+
+//
+// Resumable form of Sweep(), for spreading the work over many
+// short slices. Each slot examined costs one unit of budget; the
+// return value says whether the sweep has finished.
+//
+// The owner may keep allocating between slices. New blocks carry
+// the current trace flag, so the predicate will not reclaim them,
+// and chunks created meanwhile are linked in ahead of the cursor
+// and never visited. Empty chunks are only released once their
+// size class is done, so the cursor never points at freed memory.
+// Large blocks are few, so they are swept in one go at the end.
+//
+template<typename PredT>
+bool SlabAllocator::SweepSome(PredT isgarbage, size_t& budget, size_t& freed)
+{
+	while(SweepSizeClass < NumSizeClasses)
+	{
+		while(SweepChunk)
+		{
+			char* slot = SweepChunk->FirstSlot() + SweepSlot * SweepChunk->SlotSize;
+			while(SweepSlot < SweepChunk->BumpIndex)
+			{
+				if(!budget)
+					return false;
+
+				--budget;
+				++SweepSlot;
+
+				StringHeader* header = reinterpret_cast<StringHeader*>(slot);
+				slot += SweepChunk->SlotSize;
+
+				if(header->Owner && isgarbage(header))
+				{
+					FreeToChunk(SweepChunk, header);
+					++freed;
+				}
+			}
+
+			SweepChunk = SweepChunk->Next;
+			SweepSlot = 0;
+		}
+
+		ReleaseEmptyChunks(SweepSizeClass);
+		Current[SweepSizeClass] = Chunks[SweepSizeClass];
+
+		++SweepSizeClass;
+		if(SweepSizeClass < NumSizeClasses)
+			SweepChunk = Chunks[SweepSizeClass];
+	}
+
+	for(auto iter = LargeBlocks.begin(); iter != LargeBlocks.end(); )
+	{
+		if(isgarbage(iter->first))
+		{
+			LiveBytes -= iter->second;
+			free(iter->first);
+			iter = LargeBlocks.erase(iter);
+			++freed;
+		}
+		else
+			++iter;
+	}
+
+	Sweeping = false;
+	return true;
+}
+
@@ -0,0 +1,122 @@
+#include "stdafx.h"
+#include "StackWalk.h"
+
+
+#ifdef _WIN32
+
+
+StackFrameCursor StackWalk::CallerFrame(void* returnaddress, void* returnaddressslot)
+{
+	// MSVC does not set up a frame pointer for us on x64, so
+	// whatever is in RBP right now still belongs to the caller.
+	CONTEXT ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.ContextFlags = CONTEXT_FULL;
+	::RtlCaptureContext(&ctx);
+
+	StackFrameCursor cursor;
+	cursor.InstructionPtr = reinterpret_cast<uint64_t>(returnaddress);
+	cursor.StackPtr = reinterpret_cast<uint64_t>(returnaddressslot) + sizeof(uint64_t);
+	cursor.FramePtr = ctx.Rbp;
+	return cursor;
+}
+
+//
+// Step over a frame using the unwind data in the image's .pdata
+// section. This covers runtime frames, OS callback dispatchers,
+// and Epoch frames whose size is not fixed at compile time.
+//
+bool StackWalk::UnwindForeignFrame(StackFrameCursor* cursor)
+{
+	DWORD64 imagebase = 0;
+	PRUNTIME_FUNCTION function = ::RtlLookupFunctionEntry(cursor->InstructionPtr, &imagebase, NULL);
+	if(!function)
+		return false;
+
+	CONTEXT ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.ContextFlags = CONTEXT_FULL;
+	ctx.Rip = cursor->InstructionPtr;
+	ctx.Rsp = cursor->StackPtr;
+	ctx.Rbp = cursor->FramePtr;
+
+	PVOID handlerdata = NULL;
+	DWORD64 establisherframe = 0;
+	::RtlVirtualUnwind(UNW_FLAG_NHANDLER, imagebase, cursor->InstructionPtr, function, &ctx, &handlerdata, &establisherframe, NULL);
+
+	cursor->InstructionPtr = ctx.Rip;
+	cursor->StackPtr = ctx.Rsp;
+	cursor->FramePtr = ctx.Rbp;
+	return cursor->InstructionPtr != 0;
+}
+
+//
+// Return addresses of the frames above our caller, innermost first.
+// The OS walks these with the same unwind data as above, which is
+// much cheaper than parking the thread for a precise stack walk.
+//
+unsigned StackWalk::CaptureReturnAddresses(uint64_t* addresses, unsigned maxcount)
+{
+	static_assert(sizeof(PVOID) == sizeof(uint64_t), "Return addresses are captured in place");
+	return ::RtlCaptureStackBackTrace(1, maxcount, reinterpret_cast<PVOID*>(addresses), NULL);
+}
+
+
+#elif defined(__x86_64__)
+
+
+StackFrameCursor StackWalk::CallerFrame(void* returnaddress, void* returnaddressslot)
+{
+	// The slot sits directly above our own saved RBP, which is
+	// the caller's frame pointer.
+	const uint64_t* slot = reinterpret_cast<const uint64_t*>(returnaddressslot);
+
+	StackFrameCursor cursor;
+	cursor.InstructionPtr = reinterpret_cast<uint64_t>(returnaddress);
+	cursor.StackPtr = reinterpret_cast<uint64_t>(slot + 1);
+	cursor.FramePtr = slot[-1];
+	return cursor;
+}
+
+//
+// Without Windows-style unwind tables we rely on the frame pointer
+// chain, so foreign code on the stack must keep frame pointers. A
+// chain that does not point further up the stack ends the walk.
+//
+bool StackWalk::UnwindForeignFrame(StackFrameCursor* cursor)
+{
+	if(cursor->FramePtr < cursor->StackPtr || (cursor->FramePtr & (sizeof(uint64_t) - 1)))
+		return false;
+
+	const uint64_t* frame = reinterpret_cast<const uint64_t*>(cursor->FramePtr);
+
+	cursor->InstructionPtr = frame[1];
+	cursor->StackPtr = cursor->FramePtr + 2 * sizeof(uint64_t);
+	cursor->FramePtr = frame[0];
+	return cursor->InstructionPtr != 0;
+}
+
+unsigned StackWalk::CaptureReturnAddresses(uint64_t* addresses, unsigned maxcount)
+{
+	const uint64_t* frame = static_cast<const uint64_t*>(__builtin_frame_address(0));
+
+	unsigned count = 0;
+	while(count < maxcount && frame[1])
+	{
+		addresses[count++] = frame[1];
+
+		const uint64_t* next = reinterpret_cast<const uint64_t*>(frame[0]);
+		if(next <= frame || (reinterpret_cast<uint64_t>(next) & (sizeof(uint64_t) - 1)))
+			break;
+
+		frame = next;
+	}
+
+	return count;
+}
+
+
+#else
+#error Stack walking is not implemented for this platform
+#endif
+
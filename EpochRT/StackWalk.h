@@ -0,0 +1,41 @@
+#pragma once
+
+
+//
+// Position of one frame during a stack walk
+//
+// InstructionPtr is the return address into the frame, and
+// StackPtr is the value the stack pointer will have once that
+// address has been returned to - i.e. the frame's own stack
+// pointer at the call site, which is what GC root offsets are
+// relative to. FramePtr is only consulted when unwinding frames
+// that do not belong to compiled Epoch code.
+//
+struct StackFrameCursor
+{
+	uint64_t InstructionPtr;
+	uint64_t StackPtr;
+	uint64_t FramePtr;
+};
+
+
+namespace StackWalk
+{
+	StackFrameCursor CallerFrame(void* returnaddress, void* returnaddressslot);
+
+	bool UnwindForeignFrame(StackFrameCursor* cursor);
+
+	unsigned CaptureReturnAddresses(uint64_t* addresses, unsigned maxcount);
+}
+
+
+//
+// Must be expanded directly inside the runtime export that Epoch
+// code called, so that the cursor describes the Epoch caller.
+//
+#ifdef _WIN32
+#define STACKWALK_CALLER_FRAME() StackWalk::CallerFrame(_ReturnAddress(), _AddressOfReturnAddress())
+#else
+#define STACKWALK_CALLER_FRAME() StackWalk::CallerFrame(__builtin_return_address(0), static_cast<char*>(__builtin_frame_address(0)) + sizeof(void*))
+#endif
+
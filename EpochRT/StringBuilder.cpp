@@ -0,0 +1,83 @@
+#include "stdafx.h"
+#include "StringBuilder.h"
+#include "StringPool.h"
+#include "NumberFormat.h"
+
+
+
+StringBuilder::StringBuilder(ThreadStringPool& pool)
+	: Pool(pool),
+	  Storage(nullptr),
+	  Length(0),
+	  Capacity(0)
+{
+}
+
+
+void StringBuilder::Append(const char* s, size_t length)
+{
+	if(Length + length > Capacity)
+		Reserve(Length + length);
+
+	memcpy(GetChars() + Length, s, length);
+	Length += length;
+}
+
+void StringBuilder::AppendInteger(int value)
+{
+	char digits[NumberFormat::MaxIntegerChars];
+	Append(digits, NumberFormat::FormatInteger(digits, value));
+}
+
+void StringBuilder::AppendReal(float value)
+{
+	char digits[NumberFormat::MaxRealChars];
+	Append(digits, NumberFormat::FormatReal(digits, value));
+}
+
+
+//
+// Make room for at least the given number of characters in all.
+// Growth is geometric, so that a long run of small appends only
+// moves the contents a logarithmic number of times.
+//
+void StringBuilder::Reserve(size_t capacity)
+{
+	if(capacity <= Capacity)
+		return;
+
+	size_t newcapacity = Capacity ? Capacity * 2 : size_t(MinCapacity);
+	if(newcapacity < capacity)
+		newcapacity = capacity;
+
+	// Nothing can be collected while we copy, since allocation never
+	// waits for the collector; the old block is simply left behind
+	char* chars = Pool.AllocBuilderStorage(newcapacity);
+	if(Storage)
+		memcpy(chars, Storage, Length);
+	else
+		Pool.OpenBuilder(this);
+
+	Storage = chars;
+	Capacity = newcapacity;
+}
+
+
+//
+// Hand the storage over as a finished string. Whatever capacity was
+// left unused stays with the block until the string is freed.
+//
+const char* StringBuilder::Finish()
+{
+	if(!Storage)
+		return "";
+
+	const char* result = Pool.FinishBuilderStorage(Storage, Length);
+	Pool.CloseBuilder(this);
+
+	Storage = nullptr;
+	Length = 0;
+	Capacity = 0;
+	return result;
+}
+
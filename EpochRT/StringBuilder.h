@@ -0,0 +1,70 @@
+#pragma once
+
+
+class ThreadStringPool;
+
+
+//
+// Growable string under construction
+//
+// The characters live in an ordinary pool block sized for the
+// builder's capacity rather than its contents. While the builder
+// is open its pool treats that block as a root, so the collector
+// keeps it alive and may move it like any other string. Appending
+// writes in place, and running out of room moves the contents to
+// a block at least twice the size, so a string built up a piece at
+// a time costs amortized linear time instead of a copy per piece.
+//
+// Finishing cuts the length in the block's header down to what was
+// written and hands the block over as the finished string, without
+// copying it. The builder is then empty and may be used again.
+//
+// A builder belongs to the thread that created it, and allocates
+// from that thread's pool. The builder itself lives in that pool's
+// heap (see ThreadStringPool::AllocBuilder()) and is never destroyed
+// as such: once nothing holds it, a major collection forgets it and
+// sweeps it along with any storage it still had.
+//
+class StringBuilder
+{
+public:
+	explicit StringBuilder(ThreadStringPool& pool);
+
+	StringBuilder(const StringBuilder&) = delete;
+	StringBuilder& operator = (const StringBuilder&) = delete;
+
+public:
+	void Append(const char* s, size_t length);
+	void AppendInteger(int value);
+	void AppendReal(float value);
+
+	void Reserve(size_t capacity);
+	const char* Finish();
+
+	size_t GetLength() const
+	{
+		return Length;
+	}
+
+	// The collector updates this if it moves the storage
+	const char** GetStorageSlot()
+	{
+		return &Storage;
+	}
+
+public:
+	static const size_t MinCapacity = 64;
+
+private:
+	char* GetChars() const
+	{
+		return const_cast<char*>(Storage);
+	}
+
+private:
+	ThreadStringPool& Pool;
+	const char* Storage;
+	size_t Length;
+	size_t Capacity;
+};
+
@@ -0,0 +1,80 @@
+#pragma once
+
+
+class ThreadStringPool;
+
+
+//
+// Every pooled string lives in a single block, with this header
+// placed immediately in front of the character data. The pointer
+// handed back to Epoch code is the address just past the header,
+// so given any root the collector can reach the header with one
+// pointer subtraction instead of searching the pool.
+//
+// A null Owner marks a block that is sitting on a free list.
+//
+// When a nursery block is promoted, its TraceFlag is set to
+// ForwardedFlag and the Owner slot is reused to point at the
+// promoted copy's characters.
+//
+// Structure instances in the GC heap use the same header, with
+// the Epoch type ID of the structure in place of the length.
+//
+// Hash is computed the first time the string takes part in an
+// equality test, and is zero until then. Only the low bits of a
+// full hash are kept, which is plenty for rejecting mismatches.
+// Two threads racing to fill it in will store the same value.
+//
+// A slice is a substring that shares the characters of another
+// string. Its block holds a SliceData in place of characters, and
+// Length is the length of the substring. Slices are never null
+// terminated in place, so anything reading their characters has
+// to go through ThreadStringPool::GetChars().
+//
+// An interned string is the only one of its contents in the intern
+// table, so two interned strings are equal exactly when they are the
+// same string. Its hash is filled in when it is allocated.
+//
+// A buffer is raw bytes rather than text, and Length is its size in
+// bytes. Buffers are never moved or shared with an equal string, as
+// compiled code reads and writes them in place.
+//
+// A mapped string is a file mapped read-only into memory, whose
+// header sits just in front of the view; see MappedFileSpace.
+//
+struct StringHeader
+{
+	union
+	{
+		ThreadStringPool* Owner;
+		const char* Forward;
+	};
+
+	union
+	{
+		uint32_t Length;
+		uint32_t TypeID;
+	};
+
+	uint16_t TraceFlag;
+	uint16_t Hash : 12;
+	uint16_t IsSlice : 1;
+	uint16_t IsInterned : 1;
+	uint16_t IsBuffer : 1;
+	uint16_t IsMapped : 1;
+
+	static const uint16_t ForwardedFlag = 2;
+};
+
+
+//
+// Payload of a slice block. The base is always a pooled string that
+// is not itself a slice, and the collector keeps it alive (and moves
+// it) through this pointer.
+//
+struct SliceData
+{
+	const char* Base;
+	uint32_t Offset;
+};
+
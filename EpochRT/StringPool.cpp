@@ -1,74 +1,743 @@
 #include "stdafx.h"
 #include "StringPool.h"
+#include "GC.h"
+
+
+
+namespace
+{
+
+	//
+	// A full hash folded down to the width kept in the header. Zero
+	// means "not computed yet", so it is never produced.
+	//
+	uint16_t FoldHash(uint32_t hash)
+	{
+		uint16_t folded = static_cast<uint16_t>((hash ^ (hash >> 12)) & 0xfff);
+		return folded ? folded : 1;
+	}
+
+	//
+	// Buffers are written in place, so their hash is never kept
+	//
+	uint16_t GetHash(StringHeader* header, const char* chars)
+	{
+		if(header->IsBuffer)
+			return FoldHash(ThreadStringPool::HashChars(chars, header->Length));
+
+		if(!header->Hash)
+			header->Hash = FoldHash(ThreadStringPool::HashChars(chars, header->Length));
+
+		return header->Hash;
+	}
+
+	//
+	// Bytes following the header that make up the string: a slice's
+	// payload, or the characters and their terminator
+	//
+	size_t GetContentSize(const StringHeader* header)
+	{
+		return header->IsSlice ? sizeof(SliceData) : header->Length + 1;
+	}
+
+}
 
 
 
 ThreadStringPool::ThreadStringPool()
-	: TraceFlag(0)
+	: TraceFlag(0),
+	  AllocsSinceSweepSlice(0),
+	  UnreportedBytes(0),
+	  SampleCountdown(GC::NextSampleDistance())
 {
 }
 
 ThreadStringPool::~ThreadStringPool()
 {
-	for(auto& entry : Pool)
-		delete entry.String;
+}
+
+
+//
+// Find room for a block of the given total size, header included.
+// The caller fills in the header.
+//
+StringHeader* ThreadStringPool::AllocHeader(size_t blocksize)
+{
+	// While an incremental sweep is pending, the owning thread pays
+	// for it a slice at a time as it allocates
+	if(Slabs.IsSweeping() && ++AllocsSinceSweepSlice >= SweepSliceInterval)
+	{
+		AllocsSinceSweepSlice = 0;
+		GC::SweepSlice(this);
+	}
+
+	CountAllocation(blocksize);
+
+	StringHeader* header = nullptr;
+	if(blocksize <= Nursery::MaxBlockSize)
+	{
+		header = Young.Alloc(blocksize);
+
+		// A full nursery is as good a reason to collect as any
+		if(!header)
+			GC::RequestCollection();
+	}
+
+	// Big strings are unlikely to be temporaries and are expensive
+	// to copy, so they start out mature; so does everything else
+	// once the nursery has filled up before the next collection.
+	if(!header)
+	{
+		if(blocksize >= LargeObjectSpace::MinBlockSize)
+			header = LargeObjects.Alloc(blocksize);
+		else
+			header = Slabs.Alloc(blocksize);
+	}
+
+	// Without profiling the countdown never runs out in practice
+	if(blocksize >= SampleCountdown)
+		SampleCountdown = GC::SampleAllocation(reinterpret_cast<char*>(header + 1), blocksize);
+	else
+		SampleCountdown -= blocksize;
+
+	return header;
+}
+
+//
+// Allocate a header-prefixed block with room for the given
+// number of characters plus a null terminator. The caller is
+// responsible for filling in the character data.
+//
+char* ThreadStringPool::AllocBlock(size_t length)
+{
+	StringHeader* header = AllocHeader(sizeof(StringHeader) + length + 1);
+	header->Owner = this;
+	header->Length = static_cast<uint32_t>(length);
+	header->TraceFlag = TraceFlag;
+	header->Hash = 0;
+	header->IsSlice = 0;
+	header->IsInterned = 0;
+	header->IsBuffer = 0;
+	header->IsMapped = 0;
+
+	char* chars = reinterpret_cast<char*>(header + 1);
+	chars[length] = 0;
+	return chars;
+}
+
+
+void ThreadStringPool::CountAllocation(size_t blocksize)
+{
+	UnreportedBytes += blocksize;
+	if(UnreportedBytes >= AllocationReportBytes)
+	{
+		GC::ReportAllocation(UnreportedBytes);
+		UnreportedBytes = 0;
+	}
 }
 
 
 const char* ThreadStringPool::Alloc(const std::string& s)
 {
-	Pool.emplace_back(TraceFlag, new std::string(s));
+	return Alloc(s.data(), s.length());
+}
+
+const char* ThreadStringPool::Alloc(const char* chars, size_t length)
+{
+	char* block = AllocBlock(length);
+	memcpy(block, chars, length);
 
-	return Pool.back().String->c_str();
+	return block;
 }
 
 const char* ThreadStringPool::AllocConcat(const char* s1, const char* s2)
 {
-	std::ostringstream concat;
-	concat << s1;
-	concat << s2;
+	size_t len1;
+	size_t len2;
+	const char* chars1 = GetChars(s1, len1);
+	const char* chars2 = GetChars(s2, len2);
+
+	char* chars = AllocBlock(len1 + len2);
+	memcpy(chars, chars1, len1);
+	memcpy(chars + len1, chars2, len2);
+
+	return chars;
+}
+
+//
+// Join any number of strings with a single allocation. Lengths are
+// looked up twice rather than stored, which costs nothing for pooled
+// strings and little for the short literals that make up the rest.
+//
+const char* ThreadStringPool::AllocConcat(const char* const* parts, size_t count)
+{
+	size_t length = 0;
+	for(size_t i = 0; i < count; ++i)
+		length += GetLength(parts[i]);
 
-	Pool.emplace_back(TraceFlag, new std::string(concat.str()));
+	char* chars = AllocBlock(length);
 
-	return Pool.back().String->c_str();
+	char* out = chars;
+	for(size_t i = 0; i < count; ++i)
+	{
+		size_t partlength;
+		const char* partchars = GetChars(parts[i], partlength);
+		memcpy(out, partchars, partlength);
+		out += partlength;
+	}
+
+	return chars;
 }
 
 
-void ThreadStringPool::FreeUnusedEntries()
+//
+// The given range of a string, which the caller has checked lies
+// within it. Long substrings share the characters of the string they
+// came from, and keep it alive for as long as they live; to stop a
+// small piece from holding on to a much bigger string, substrings
+// under a quarter of their base are copied all the same.
+//
+const char* ThreadStringPool::AllocSubstring(const char* s, size_t offset, size_t length)
 {
-	uint32_t count = 0;
-	uint32_t bit = TraceFlag;
-	auto iter = std::remove_if(Pool.begin(), Pool.end(), [bit, &count](const PoolEntry& entry) {
-		if(entry.TraceFlag != bit)
-		{
-			++count;
-			delete entry.String;
-			return true;
-		}
+	StringHeader* header = FindHeader(s);
+
+	const char* base = s;
+	size_t baselength = header ? header->Length : strlen(s);
+	if(header && header->IsSlice)
+	{
+		const SliceData* slice = reinterpret_cast<const SliceData*>(s);
+		base = slice->Base;
+		offset += slice->Offset;
+		baselength = GetHeader(base)->Length;
+	}
+
+	if(!header || length < MinSliceLength || length * 4 < baselength)
+		return Alloc(base + offset, length);
+
+	StringHeader* sliceheader = AllocHeader(sizeof(StringHeader) + sizeof(SliceData));
+	sliceheader->Owner = this;
+	sliceheader->Length = static_cast<uint32_t>(length);
+	sliceheader->TraceFlag = TraceFlag;
+	sliceheader->Hash = 0;
+	sliceheader->IsSlice = 1;
+	sliceheader->IsInterned = 0;
+	sliceheader->IsBuffer = 0;
+	sliceheader->IsMapped = 0;
+
+	SliceData* slice = reinterpret_cast<SliceData*>(sliceheader + 1);
+	slice->Base = base;
+	slice->Offset = static_cast<uint32_t>(offset);
+	return reinterpret_cast<const char*>(slice);
+}
+
+//
+// A null terminated copy of a slice, for code that cannot read
+// slices; any other string is returned as it is
+//
+const char* ThreadStringPool::Materialize(const char* s)
+{
+	if(!FindSlice(s))
+		return s;
+
+	size_t length;
+	const char* chars = GetChars(s, length);
+	return Alloc(chars, length);
+}
+
+
+//
+// Storage for a new entry in the intern table. Interned strings go
+// straight to the mature heap, since the table's reference to them
+// is weak and would not see them promoted. Everything in the header
+// is final before the string is published, so that no thread ever
+// has to write to it afterwards.
+//
+const char* ThreadStringPool::AllocInterned(const char* chars, size_t length, uint32_t hash)
+{
+	size_t blocksize = sizeof(StringHeader) + length + 1;
+	CountAllocation(blocksize);
+
+	StringHeader* header;
+	if(blocksize >= LargeObjectSpace::MinBlockSize)
+		header = LargeObjects.Alloc(blocksize);
+	else
+		header = Slabs.Alloc(blocksize);
+
+	header->Owner = this;
+	header->Length = static_cast<uint32_t>(length);
+	header->TraceFlag = TraceFlag;
+	header->Hash = FoldHash(hash);
+	header->IsSlice = 0;
+	header->IsInterned = 1;
+	header->IsBuffer = 0;
+	header->IsMapped = 0;
+
+	char* interned = reinterpret_cast<char*>(header + 1);
+	memcpy(interned, chars, length);
+	interned[length] = 0;
+	return interned;
+}
+
+
+//
+// Length of any Epoch string, pooled or not. Pooled strings (slices
+// included) know their own length; anything else has to be scanned.
+//
+size_t ThreadStringPool::GetLength(const char* s)
+{
+	const StringHeader* header = FindHeader(s);
+	return header ? header->Length : strlen(s);
+}
+
+//
+// FNV-1a over the characters of a string
+//
+uint32_t ThreadStringPool::HashChars(const char* chars, size_t length)
+{
+	uint32_t hash = 2166136261u;
+	for(size_t i = 0; i < length; ++i)
+	{
+		hash ^= static_cast<unsigned char>(chars[i]);
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+//
+// Cheap tests first: identity (which settles it for two interned
+// strings), then length, then the hashes of two pooled strings. The
+// characters are only compared when all of those agree.
+//
+bool ThreadStringPool::Equals(const char* s1, const char* s2)
+{
+	if(s1 == s2)
+		return true;
 
+	StringHeader* header1 = FindHeader(s1);
+	StringHeader* header2 = FindHeader(s2);
+	if(header1 && header2 && header1->IsInterned && header2->IsInterned)
+		return false;
+
+	size_t len1;
+	size_t len2;
+	const char* chars1 = GetChars(s1, header1, len1);
+	const char* chars2 = GetChars(s2, header2, len2);
+	if(len1 != len2)
+		return false;
+
+	if(header1 && header2 && GetHash(header1, chars1) != GetHash(header2, chars2))
 		return false;
-	});
 
-	Pool.erase(iter, Pool.end());
+	return memcmp(chars1, chars2, len1) == 0;
 }
 
 
-void ThreadStringPool::ToggleTraceBit()
+//
+// Allocate a zeroed structure instance in the GC heap. Structures go
+// straight to the mature heap; they are rarely short-lived enough
+// (being boxed precisely because they outlive their frame) to be
+// worth copying out of the nursery.
+//
+void* ThreadStringPool::AllocStructure(uint32_t epochtype, size_t size)
 {
-	TraceFlag = 1 - TraceFlag;
+	size_t blocksize = sizeof(StringHeader) + size;
+	CountAllocation(blocksize);
+
+	StringHeader* header = Structures.Alloc(blocksize);
+	header->Owner = this;
+	header->TypeID = epochtype;
+	header->TraceFlag = TraceFlag;
+	header->Hash = 0;
+	header->IsSlice = 0;
+	header->IsInterned = 0;
+	header->IsBuffer = 0;
+	header->IsMapped = 0;
+
+	void* p = header + 1;
+	memset(p, 0, size);
+	return p;
+}
+
+
+//
+// A zero-filled buffer of the given size. Small buffers have a slab
+// of their own, apart from the strings so that compaction never sees
+// them. Anything too big for a slab slot gets a mapping like a large
+// string, which keeps every buffer where FindHeader() can see it.
+// Neither kind ever moves. The block is terminated like a string, so
+// a buffer holding text can be read as one.
+//
+char* ThreadStringPool::AllocBuffer(size_t size)
+{
+	size_t blocksize = sizeof(StringHeader) + size + 1;
+	CountAllocation(blocksize);
+
+	StringHeader* header;
+	if(blocksize > SlabAllocator::MaxSlotSize)
+		header = LargeObjects.Alloc(blocksize);
+	else
+		header = Buffers.Alloc(blocksize);
+
+	header->Owner = this;
+	header->Length = static_cast<uint32_t>(size);
+	header->TraceFlag = TraceFlag;
+	header->Hash = 0;
+	header->IsSlice = 0;
+	header->IsInterned = 0;
+	header->IsBuffer = 1;
+	header->IsMapped = 0;
+
+	char* bytes = reinterpret_cast<char*>(header + 1);
+	memset(bytes, 0, size + 1);
+	return bytes;
 }
 
 
-void ThreadStringPool::MarkInUse(const char* p)
+//
+// The whole contents of a file as a string, or null if the file
+// cannot be read. Where it can, the file is mapped rather than read
+// (see MappedFileSpace); otherwise it is read into an ordinary block,
+// whose length comes out short if the file could not be read to the
+// end. Either way the string is collected like any other.
+//
+const char* ThreadStringPool::MapFile(const char* filename)
 {
-	for(auto& entry : Pool)
+	size_t filesize;
+	StringHeader* header = MappedFiles.Map(filename, filesize);
+	if(!header)
 	{
-		if(entry.String->c_str() == p)
+		if(filesize == MappedFileSpace::UnreadableFile)
+			return nullptr;
+
+		char* chars = AllocBlock(filesize);
+		size_t read = MappedFileSpace::ReadWhole(filename, chars, filesize);
+		if(read < filesize)
 		{
-			entry.TraceFlag = TraceFlag;
-			return;
+			GetHeader(chars)->Length = static_cast<uint32_t>(read);
+			chars[read] = 0;
 		}
+
+		return chars;
+	}
+
+	CountAllocation(sizeof(StringHeader) + filesize);
+
+	header->Owner = this;
+	header->Length = static_cast<uint32_t>(filesize);
+	header->TraceFlag = TraceFlag;
+	header->Hash = 0;
+	header->IsSlice = 0;
+	header->IsInterned = 0;
+	header->IsBuffer = 0;
+	header->IsMapped = 1;
+
+	return reinterpret_cast<char*>(header + 1);
+}
+
+
+//
+// A builder is itself a block in the buffer slab, so the variable
+// holding it is what keeps it alive, and it never moves while code
+// holds its address. Nothing needs tearing down when it goes: see
+// CloseUnreachableBuilders().
+//
+StringBuilder* ThreadStringPool::AllocBuilder()
+{
+	return new(AllocBuffer(sizeof(StringBuilder))) StringBuilder(*this);
+}
+
+//
+// Storage for a string builder is an ordinary block whose length
+// is its capacity, so that it is traced, promoted and evacuated
+// whole like any other string for as long as the builder is open.
+//
+char* ThreadStringPool::AllocBuilderStorage(size_t capacity)
+{
+	return AllocBlock(capacity);
+}
+
+//
+// Turn a builder's storage into the finished string in place. The
+// slot it sits in keeps its size, whatever the header now says.
+//
+const char* ThreadStringPool::FinishBuilderStorage(const char* storage, size_t length)
+{
+	StringHeader* header = GetHeader(storage);
+	header->Length = static_cast<uint32_t>(length);
+	header->Hash = 0;
+
+	const_cast<char*>(storage)[length] = 0;
+	return storage;
+}
+
+void ThreadStringPool::OpenBuilder(StringBuilder* builder)
+{
+	Builders.insert(builder);
+}
+
+void ThreadStringPool::CloseBuilder(StringBuilder* builder)
+{
+	Builders.erase(builder);
+}
+
+//
+// Forget every open builder that a major collection did not reach.
+// Their storage is then no longer a root, and is swept along with
+// the builders themselves.
+//
+void ThreadStringPool::CloseUnreachableBuilders()
+{
+	for(auto iter = Builders.begin(); iter != Builders.end(); )
+	{
+		if(IsMarked(reinterpret_cast<const char*>(*iter)))
+			++iter;
+		else
+			iter = Builders.erase(iter);
 	}
 }
 
 
+//
+// Copy a nursery string into our mature heap and leave a forwarding
+// pointer behind, so that any other reference to the same string
+// is redirected to the copy instead of copying it again.
+//
+const char* ThreadStringPool::Promote(const char* s)
+{
+	StringHeader* header = GetHeader(s);
+	if(header->TraceFlag == StringHeader::ForwardedFlag)
+		return header->Forward;
+
+	size_t contentsize = GetContentSize(header);
+
+	StringHeader* promoted = Slabs.Alloc(sizeof(StringHeader) + contentsize);
+	promoted->Owner = this;
+	promoted->Length = header->Length;
+	promoted->TraceFlag = TraceFlag;
+	promoted->Hash = header->Hash;
+	promoted->IsSlice = header->IsSlice;
+	promoted->IsInterned = header->IsInterned;
+	promoted->IsBuffer = 0;
+	promoted->IsMapped = 0;
+
+	char* chars = reinterpret_cast<char*>(promoted + 1);
+	memcpy(chars, s, contentsize);
+
+	header->Forward = chars;
+	header->TraceFlag = StringHeader::ForwardedFlag;
+	return chars;
+}
+
+//
+// Only safe once every live nursery string has been promoted and
+// every reference to it updated.
+//
+void ThreadStringPool::ResetNursery()
+{
+	Young.Reset();
+}
+
+
+//
+// Sweep the whole mature heap in one go, returning the number of
+// blocks freed.
+//
+size_t ThreadStringPool::FreeUnusedEntries()
+{
+	size_t freedentries = 0;
+
+	BeginSweep();
+	SweepSome(~size_t(0), freedentries);
+	return freedentries;
+}
+
+
+void ThreadStringPool::BeginSweep()
+{
+	Slabs.BeginSweep();
+	AllocsSinceSweepSlice = 0;
+}
+
+//
+// Free up to budget slots' worth of unmarked blocks, adding the
+// number freed to freedentries. Returns true once nothing is left
+// to sweep.
+//
+bool ThreadStringPool::SweepSome(size_t budget, size_t& freedentries)
+{
+	uint32_t bit = TraceFlag;
+
+	return Slabs.SweepSome([bit](const StringHeader* header) {
+		return header->TraceFlag != bit;
+	}, budget, freedentries);
+}
+
+
+void ThreadStringPool::ToggleTraceBit()
+{
+	TraceFlag = 1 - TraceFlag;
+}
+
+
+//
+// Mark a pooled string as reachable. Static strings are filtered
+// out by the collector before we get here; anything else we did
+// not allocate ourselves (another thread's string, or a char*
+// handed back by an external C function) is ignored, and we
+// return false so the collector can try the next pool.
+//
+bool ThreadStringPool::MarkInUse(const char* p)
+{
+	StringHeader* header = GetHeader(p);
+	if(!Slabs.Owns(header) && !LargeObjects.Owns(header) && !Buffers.Owns(header) && !MappedFiles.Owns(header))
+		return false;
+
+	header->TraceFlag = TraceFlag;
+	return true;
+}
+
+
+//
+// Structure counterpart of MarkInUse()
+//
+bool ThreadStringPool::MarkStructure(void* p)
+{
+	StringHeader* header = GetStructureHeader(p);
+	if(!Structures.Owns(header))
+		return false;
+
+	header->TraceFlag = TraceFlag;
+	return true;
+}
+
+//
+// Structures are swept eagerly during the pause, since an incremental
+// sweep would need the mutator to mark structures it writes into.
+//
+size_t ThreadStringPool::FreeUnusedStructures()
+{
+	uint32_t bit = TraceFlag;
+
+	return Structures.Sweep([bit](const StringHeader* header) {
+		return header->TraceFlag != bit;
+	});
+}
+
+//
+// Buffers are marked through the same roots as strings, but never
+// move, so like structures they are swept during the pause.
+//
+size_t ThreadStringPool::FreeUnusedBuffers()
+{
+	uint32_t bit = TraceFlag;
+
+	return Buffers.Sweep([bit](const StringHeader* header) {
+		return header->TraceFlag != bit;
+	});
+}
+
+
+//
+// Keep a mature string at its current address, for as long as it
+// lives. Returns false if the string is not ours. Large strings,
+// buffers and mapped files never move, so there is nothing to do
+// for them.
+//
+bool ThreadStringPool::Pin(const char* s)
+{
+	StringHeader* header = GetHeader(s);
+	if(LargeObjects.Owns(header) || Buffers.Owns(header) || MappedFiles.Owns(header))
+		return true;
+
+	if(!Slabs.Owns(header))
+		return false;
+
+	Slabs.Pin(header);
+	return true;
+}
+
+void ThreadStringPool::ClearPins()
+{
+	Slabs.ClearPins();
+}
+
+//
+// Compaction, first half: move the strings in sparsely occupied
+// chunks into the rest of the mature heap, leaving each old header
+// forwarding to the new copy the same way a promoted nursery string
+// does. The sweep must be complete. Returns the number of strings
+// moved.
+//
+size_t ThreadStringPool::EvacuateSparseChunks(unsigned maxoccupancypercent)
+{
+	if(!Slabs.BeginEvacuation(maxoccupancypercent))
+		return 0;
+
+	return Slabs.Evacuate([](StringHeader* from, StringHeader* to) {
+		memcpy(to, from, sizeof(StringHeader) + GetContentSize(from));
+
+		from->Forward = reinterpret_cast<char*>(to + 1);
+		from->TraceFlag = StringHeader::ForwardedFlag;
+	});
+}
+
+//
+// Compaction, second half: once every reference has been redirected,
+// hand the emptied chunks back. Returns the number of chunks freed.
+//
+size_t ThreadStringPool::ReleaseEvacuatedChunks()
+{
+	return Slabs.FinishEvacuation();
+}
+
+
+//
+// Large strings are swept in the pause even when the rest of the
+// heap is swept incrementally. There are few of them, and unmapping
+// them promptly is the whole point of keeping them apart.
+//
+size_t ThreadStringPool::FreeUnusedLargeObjects()
+{
+	uint32_t bit = TraceFlag;
+
+	return LargeObjects.Sweep([bit](const StringHeader* header) {
+		return header->TraceFlag != bit;
+	});
+}
+
+//
+// Mapped files go the same way, so that a file is not held open by
+// a view nobody can reach
+//
+size_t ThreadStringPool::FreeUnusedMappedFiles()
+{
+	uint32_t bit = TraceFlag;
+
+	return MappedFiles.Sweep([bit](const StringHeader* header) {
+		return header->TraceFlag != bit;
+	});
+}
+
+//
+// Hand back memory held in reserve: spare empty chunks, and the
+// physical pages behind the (empty) nursery. Only worth doing after
+// a collection has freed a good part of the heap. Returns the number
+// of chunks released.
+//
+size_t ThreadStringPool::Trim()
+{
+	Young.Trim();
+
+	size_t released = Structures.Trim() + Buffers.Trim();
+	if(!Slabs.IsSweeping())
+		released += Slabs.Trim();
+
+	return released;
+}
+
+
+bool ThreadStringPool::IsEmpty() const
+{
+	return Slabs.IsEmpty() && LargeObjects.IsEmpty() && Structures.IsEmpty() && Buffers.IsEmpty() && MappedFiles.IsEmpty();
+}
@@ -1,6 +1,15 @@
 #pragma once
 
 
+#include "StringHeader.h"
+#include "SlabAllocator.h"
+#include "LargeObjectSpace.h"
+#include "MappedFileSpace.h"
+#include "Nursery.h"
+#include "HeapMap.h"
+#include "StringBuilder.h"
+
+
 class ThreadStringPool
 {
 public:
@@ -9,25 +18,197 @@ public:
 
 public:
 	const char* Alloc(const std::string& s);
+	const char* Alloc(const char* chars, size_t length);
 	const char* AllocConcat(const char* s1, const char* s2);
+	const char* AllocConcat(const char* const* parts, size_t count);
+
+	const char* AllocSubstring(const char* s, size_t offset, size_t length);
+	const char* Materialize(const char* s);
+
+	const char* AllocInterned(const char* chars, size_t length, uint32_t hash);
+
+	void* AllocStructure(uint32_t epochtype, size_t size);
+	char* AllocBuffer(size_t size);
+
+	const char* MapFile(const char* filename);
+
+	StringBuilder* AllocBuilder();
+	char* AllocBuilderStorage(size_t capacity);
+	const char* FinishBuilderStorage(const char* storage, size_t length);
+
+	void OpenBuilder(StringBuilder* builder);
+	void CloseBuilder(StringBuilder* builder);
+	void CloseUnreachableBuilders();
 
-	void MarkInUse(const char* s);
+	template<typename FuncT>
+	void ForEachBuilderStorage(FuncT func)
+	{
+		for(StringBuilder* builder : Builders)
+			func(builder->GetStorageSlot());
+	}
+
+	bool InNursery(const char* s) const
+	{
+		return Young.Contains(s);
+	}
+
+	const char* Promote(const char* s);
+	void ResetNursery();
+
+	bool MarkInUse(const char* s);
 	void ToggleTraceBit();
-	void FreeUnusedEntries();
+	size_t FreeUnusedEntries();
+
+	bool IsMarked(const char* s) const
+	{
+		return GetHeader(s)->TraceFlag == TraceFlag;
+	}
+
+	void BeginSweep();
+	bool SweepSome(size_t budget, size_t& freedentries);
+
+	bool IsSweeping() const
+	{
+		return Slabs.IsSweeping();
+	}
+
+	bool Pin(const char* s);
+	void ClearPins();
+
+	size_t EvacuateSparseChunks(unsigned maxoccupancypercent);
+	size_t ReleaseEvacuatedChunks();
+
+	size_t FreeUnusedLargeObjects();
+	size_t FreeUnusedMappedFiles();
+	size_t Trim();
+
+	bool IsEvacuating(const char* s) const
+	{
+		return Slabs.IsEvacuating(s);
+	}
+
+	bool MarkStructure(void* p);
+	size_t FreeUnusedStructures();
+	size_t FreeUnusedBuffers();
+
+	template<typename FuncT>
+	void ForEachStructure(FuncT func)
+	{
+		Structures.ForEachBlock([&func](StringHeader* header) {
+			func(header + 1, header->TypeID);
+		});
+	}
+
+	bool IsEmpty() const;
+
+	size_t GetMatureBytes() const
+	{
+		return Slabs.GetLiveBytes() + LargeObjects.GetLiveBytes() + Structures.GetLiveBytes() + Buffers.GetLiveBytes() + MappedFiles.GetLiveBytes();
+	}
+
+	size_t GetNurseryBytes() const
+	{
+		return Young.GetUsedBytes();
+	}
+
+	size_t GetCommittedBytes() const
+	{
+		return Slabs.GetCommittedBytes() + LargeObjects.GetCommittedBytes() + Structures.GetCommittedBytes() + Buffers.GetCommittedBytes() + MappedFiles.GetCommittedBytes() + Nursery::Size;
+	}
+
+public:
+	static const uint32_t SweepSliceInterval = 64;
+	static const size_t AllocationReportBytes = 64 * 1024;
+
+	// Shorter substrings are copied, which is as cheap as making the
+	// slice and lets go of the string they came from
+	static const size_t MinSliceLength = 64;
+
+	static StringHeader* GetHeader(const char* s)
+	{
+		return reinterpret_cast<StringHeader*>(const_cast<char*>(s) - sizeof(StringHeader));
+	}
+
+	static StringHeader* GetStructureHeader(const void* p)
+	{
+		return GetHeader(static_cast<const char*>(p));
+	}
+
+	//
+	// Strings may also be literals in an image or belong to native
+	// code, in which case there is no header to find
+	//
+	static StringHeader* FindHeader(const char* s)
+	{
+		return HeapMap::Contains(s) ? GetHeader(s) : nullptr;
+	}
+
+	static SliceData* FindSlice(const char* s)
+	{
+		StringHeader* header = FindHeader(s);
+		if(!header || !header->IsSlice)
+			return nullptr;
+
+		return reinterpret_cast<SliceData*>(const_cast<char*>(s));
+	}
+
+	//
+	// Characters and length of any Epoch string. For a slice these are
+	// found in its base string, and are not null terminated.
+	//
+	static const char* GetChars(const char* s, size_t& length)
+	{
+		return GetChars(s, FindHeader(s), length);
+	}
+
+	static size_t GetLength(const char* s);
+	static bool Equals(const char* s1, const char* s2);
+
+	static uint32_t HashChars(const char* chars, size_t length);
 
 private:
-	struct PoolEntry
+	static const char* GetChars(const char* s, const StringHeader* header, size_t& length)
 	{
-		PoolEntry(uint32_t tf, std::string* s)
-			: TraceFlag(tf),
-			  String(s)
-		{ }
+		if(!header)
+		{
+			length = strlen(s);
+			return s;
+		}
+
+		length = header->Length;
+		if(!header->IsSlice)
+			return s;
+
+		const SliceData* slice = reinterpret_cast<const SliceData*>(s);
+		return slice->Base + slice->Offset;
+	}
+
+private:
+	StringHeader* AllocHeader(size_t blocksize);
+	char* AllocBlock(size_t length);
+	void CountAllocation(size_t blocksize);
+
+private:
+	uint16_t TraceFlag;
+	uint32_t AllocsSinceSweepSlice;
+	size_t UnreportedBytes;
+	size_t SampleCountdown;
+	Nursery Young;
+	SlabAllocator Slabs;
+	LargeObjectSpace LargeObjects;
+
+	// Structures never move, since compiled code holds their addresses
+	// as plain integers inside sum types
+	SlabAllocator Structures;
+
+	// Buffers never move either, since compiled code reads and writes
+	// them directly
+	SlabAllocator Buffers;
 
-		uint32_t TraceFlag;
-		const std::string* String;
-	};
+	MappedFileSpace MappedFiles;
 
-	uint32_t TraceFlag;
-	std::vector<PoolEntry> Pool;
+	// Builders with storage, whose blocks are roots until finished or
+	// until the builder itself is found unreachable
+	std::unordered_set<StringBuilder*> Builders;
 };
 
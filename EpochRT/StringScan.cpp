@@ -0,0 +1,526 @@
+#include "stdafx.h"
+#include "StringScan.h"
+
+
+#include <atomic>
+#include <cstring>
+
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define STRINGSCAN_AVX2
+#else
+#include <cpuid.h>
+#define STRINGSCAN_AVX2 __attribute__((target("avx2")))
+#endif
+
+
+
+namespace
+{
+
+	struct Kernels
+	{
+		size_t (*FindChar)(const char* s, size_t length, char c, size_t start);
+		size_t (*Find)(const char* s, size_t length, const char* needle, size_t needlelength, size_t start);
+		size_t (*FindAnyOf)(const char* s, size_t length, const char* set, size_t setlength, size_t start);
+		size_t (*SkipClass)(const char* s, size_t length, unsigned classes, size_t start);
+	};
+
+	// Sets larger than this are matched a character at a time
+	// against a lookup table instead of one compare per member
+	const size_t MaxVectorSetLength = 8;
+
+
+	inline unsigned LowestBit(uint32_t mask)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return index;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+
+	inline unsigned ClassOf(unsigned char c)
+	{
+		if(c == ' ' || c == '\t' || c == '\r' || c == '\n')
+			return StringScan::ClassWhitespace;
+
+		if(unsigned(c - '0') < 10)
+			return StringScan::ClassDigit;
+
+		if(unsigned((c | 0x20) - 'a') < 26)
+			return StringScan::ClassAlpha;
+
+		if(c == '_')
+			return StringScan::ClassUnderscore;
+
+		return 0;
+	}
+
+
+	//
+	// Scalar kernels, which also finish off whatever is left over
+	// once there is less than a full vector to look at
+	//
+
+	size_t ScalarFindChar(const char* s, size_t length, char c, size_t start)
+	{
+		if(start >= length)
+			return StringScan::NotFound;
+
+		const void* found = memchr(s + start, c, length - start);
+		if(!found)
+			return StringScan::NotFound;
+
+		return static_cast<const char*>(found) - s;
+	}
+
+	size_t ScalarFind(const char* s, size_t length, const char* needle, size_t needlelength, size_t start)
+	{
+		for(size_t i = start; i + needlelength <= length; ++i)
+		{
+			if(s[i] == needle[0] && memcmp(s + i + 1, needle + 1, needlelength - 1) == 0)
+				return i;
+		}
+
+		return StringScan::NotFound;
+	}
+
+	size_t ScalarFindAnyOf(const char* s, size_t length, const char* set, size_t setlength, size_t start)
+	{
+		if(setlength <= MaxVectorSetLength)
+		{
+			for(size_t i = start; i < length; ++i)
+			{
+				if(memchr(set, s[i], setlength))
+					return i;
+			}
+
+			return StringScan::NotFound;
+		}
+
+		bool members[256] = { false };
+		for(size_t i = 0; i < setlength; ++i)
+			members[static_cast<unsigned char>(set[i])] = true;
+
+		for(size_t i = start; i < length; ++i)
+		{
+			if(members[static_cast<unsigned char>(s[i])])
+				return i;
+		}
+
+		return StringScan::NotFound;
+	}
+
+	size_t ScalarSkipClass(const char* s, size_t length, unsigned classes, size_t start)
+	{
+		for(size_t i = start; i < length; ++i)
+		{
+			if(!(ClassOf(static_cast<unsigned char>(s[i])) & classes))
+				return i;
+		}
+
+		return StringScan::NotFound;
+	}
+
+
+	//
+	// SSE2 kernels, 16 characters per step
+	//
+
+	size_t SSE2FindChar(const char* s, size_t length, char c, size_t start)
+	{
+		const __m128i pattern = _mm_set1_epi8(c);
+
+		size_t i = start;
+		for(; i + 16 <= length; i += 16)
+		{
+			__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+			uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, pattern));
+			if(mask)
+				return i + LowestBit(mask);
+		}
+
+		return ScalarFindChar(s, length, c, i);
+	}
+
+	//
+	// Candidates are positions where both the first and the last
+	// character of the needle line up, which rules out nearly all
+	// of them before we compare anything else.
+	//
+	size_t SSE2Find(const char* s, size_t length, const char* needle, size_t needlelength, size_t start)
+	{
+		const __m128i first = _mm_set1_epi8(needle[0]);
+		const __m128i last = _mm_set1_epi8(needle[needlelength - 1]);
+
+		size_t i = start;
+		for(; i + needlelength - 1 + 16 <= length; i += 16)
+		{
+			__m128i blockfirst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+			__m128i blocklast = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + needlelength - 1));
+
+			uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(blockfirst, first), _mm_cmpeq_epi8(blocklast, last)));
+			while(mask)
+			{
+				size_t candidate = i + LowestBit(mask);
+				if(needlelength <= 2 || memcmp(s + candidate + 1, needle + 1, needlelength - 2) == 0)
+					return candidate;
+
+				mask &= mask - 1;
+			}
+		}
+
+		return ScalarFind(s, length, needle, needlelength, i);
+	}
+
+	size_t SSE2FindAnyOf(const char* s, size_t length, const char* set, size_t setlength, size_t start)
+	{
+		if(setlength > MaxVectorSetLength)
+			return ScalarFindAnyOf(s, length, set, setlength, start);
+
+		__m128i patterns[MaxVectorSetLength];
+		for(size_t j = 0; j < setlength; ++j)
+			patterns[j] = _mm_set1_epi8(set[j]);
+
+		size_t i = start;
+		for(; i + 16 <= length; i += 16)
+		{
+			__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+
+			__m128i matches = _mm_cmpeq_epi8(block, patterns[0]);
+			for(size_t j = 1; j < setlength; ++j)
+				matches = _mm_or_si128(matches, _mm_cmpeq_epi8(block, patterns[j]));
+
+			uint32_t mask = _mm_movemask_epi8(matches);
+			if(mask)
+				return i + LowestBit(mask);
+		}
+
+		return ScalarFindAnyOf(s, length, set, setlength, i);
+	}
+
+	//
+	// Ranges are tested with a single signed compare by first
+	// subtracting the bottom of the range and flipping the sign
+	// bit, which turns an unsigned "below n" into a signed one.
+	//
+	inline __m128i SSE2InRange(__m128i block, char low, unsigned count)
+	{
+		const __m128i bias = _mm_set1_epi8(static_cast<char>(0x80));
+		__m128i offset = _mm_xor_si128(_mm_sub_epi8(block, _mm_set1_epi8(low)), bias);
+		return _mm_cmpgt_epi8(_mm_set1_epi8(static_cast<char>(0x80 + count)), offset);
+	}
+
+	size_t SSE2SkipClass(const char* s, size_t length, unsigned classes, size_t start)
+	{
+		size_t i = start;
+		for(; i + 16 <= length; i += 16)
+		{
+			__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+			__m128i members = _mm_setzero_si128();
+
+			if(classes & StringScan::ClassWhitespace)
+			{
+				members = _mm_or_si128(members, _mm_cmpeq_epi8(block, _mm_set1_epi8(' ')));
+				members = _mm_or_si128(members, _mm_cmpeq_epi8(block, _mm_set1_epi8('\t')));
+				members = _mm_or_si128(members, _mm_cmpeq_epi8(block, _mm_set1_epi8('\r')));
+				members = _mm_or_si128(members, _mm_cmpeq_epi8(block, _mm_set1_epi8('\n')));
+			}
+
+			if(classes & StringScan::ClassDigit)
+				members = _mm_or_si128(members, SSE2InRange(block, '0', 10));
+
+			if(classes & StringScan::ClassAlpha)
+				members = _mm_or_si128(members, SSE2InRange(_mm_or_si128(block, _mm_set1_epi8(0x20)), 'a', 26));
+
+			if(classes & StringScan::ClassUnderscore)
+				members = _mm_or_si128(members, _mm_cmpeq_epi8(block, _mm_set1_epi8('_')));
+
+			uint32_t mask = ~_mm_movemask_epi8(members) & 0xffff;
+			if(mask)
+				return i + LowestBit(mask);
+		}
+
+		return ScalarSkipClass(s, length, classes, i);
+	}
+
+
+	//
+	// AVX2 kernels, 32 characters per step; these mirror the SSE2
+	// ones above
+	//
+
+	STRINGSCAN_AVX2 size_t AVX2FindChar(const char* s, size_t length, char c, size_t start)
+	{
+		const __m256i pattern = _mm256_set1_epi8(c);
+
+		size_t i = start;
+		for(; i + 32 <= length; i += 32)
+		{
+			__m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+			uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, pattern));
+			if(mask)
+				return i + LowestBit(mask);
+		}
+
+		return SSE2FindChar(s, length, c, i);
+	}
+
+	STRINGSCAN_AVX2 size_t AVX2Find(const char* s, size_t length, const char* needle, size_t needlelength, size_t start)
+	{
+		const __m256i first = _mm256_set1_epi8(needle[0]);
+		const __m256i last = _mm256_set1_epi8(needle[needlelength - 1]);
+
+		size_t i = start;
+		for(; i + needlelength - 1 + 32 <= length; i += 32)
+		{
+			__m256i blockfirst = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+			__m256i blocklast = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i + needlelength - 1));
+
+			uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(blockfirst, first), _mm256_cmpeq_epi8(blocklast, last)));
+			while(mask)
+			{
+				size_t candidate = i + LowestBit(mask);
+				if(needlelength <= 2 || memcmp(s + candidate + 1, needle + 1, needlelength - 2) == 0)
+					return candidate;
+
+				mask &= mask - 1;
+			}
+		}
+
+		return SSE2Find(s, length, needle, needlelength, i);
+	}
+
+	STRINGSCAN_AVX2 size_t AVX2FindAnyOf(const char* s, size_t length, const char* set, size_t setlength, size_t start)
+	{
+		if(setlength > MaxVectorSetLength)
+			return ScalarFindAnyOf(s, length, set, setlength, start);
+
+		__m256i patterns[MaxVectorSetLength];
+		for(size_t j = 0; j < setlength; ++j)
+			patterns[j] = _mm256_set1_epi8(set[j]);
+
+		size_t i = start;
+		for(; i + 32 <= length; i += 32)
+		{
+			__m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+
+			__m256i matches = _mm256_cmpeq_epi8(block, patterns[0]);
+			for(size_t j = 1; j < setlength; ++j)
+				matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(block, patterns[j]));
+
+			uint32_t mask = _mm256_movemask_epi8(matches);
+			if(mask)
+				return i + LowestBit(mask);
+		}
+
+		return SSE2FindAnyOf(s, length, set, setlength, i);
+	}
+
+	STRINGSCAN_AVX2 inline __m256i AVX2InRange(__m256i block, char low, unsigned count)
+	{
+		const __m256i bias = _mm256_set1_epi8(static_cast<char>(0x80));
+		__m256i offset = _mm256_xor_si256(_mm256_sub_epi8(block, _mm256_set1_epi8(low)), bias);
+		return _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(0x80 + count)), offset);
+	}
+
+	STRINGSCAN_AVX2 size_t AVX2SkipClass(const char* s, size_t length, unsigned classes, size_t start)
+	{
+		size_t i = start;
+		for(; i + 32 <= length; i += 32)
+		{
+			__m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+			__m256i members = _mm256_setzero_si256();
+
+			if(classes & StringScan::ClassWhitespace)
+			{
+				members = _mm256_or_si256(members, _mm256_cmpeq_epi8(block, _mm256_set1_epi8(' ')));
+				members = _mm256_or_si256(members, _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\t')));
+				members = _mm256_or_si256(members, _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\r')));
+				members = _mm256_or_si256(members, _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\n')));
+			}
+
+			if(classes & StringScan::ClassDigit)
+				members = _mm256_or_si256(members, AVX2InRange(block, '0', 10));
+
+			if(classes & StringScan::ClassAlpha)
+				members = _mm256_or_si256(members, AVX2InRange(_mm256_or_si256(block, _mm256_set1_epi8(0x20)), 'a', 26));
+
+			if(classes & StringScan::ClassUnderscore)
+				members = _mm256_or_si256(members, _mm256_cmpeq_epi8(block, _mm256_set1_epi8('_')));
+
+			uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(members));
+			if(mask)
+				return i + LowestBit(mask);
+		}
+
+		return SSE2SkipClass(s, length, classes, i);
+	}
+
+
+	const Kernels LevelKernels[] =
+	{
+		{ ScalarFindChar, ScalarFind, ScalarFindAnyOf, ScalarSkipClass },
+		{ SSE2FindChar, SSE2Find, SSE2FindAnyOf, SSE2SkipClass },
+		{ AVX2FindChar, AVX2Find, AVX2FindAnyOf, AVX2SkipClass },
+	};
+
+
+	void CPUID(int info[4], int leaf)
+	{
+#ifdef _MSC_VER
+		__cpuidex(info, leaf, 0);
+#else
+		__cpuid_count(leaf, 0, info[0], info[1], info[2], info[3]);
+#endif
+	}
+
+	uint64_t ReadXCR0()
+	{
+#ifdef _MSC_VER
+		return _xgetbv(0);
+#else
+		uint32_t low, high;
+		__asm__ volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+		return (uint64_t(high) << 32) | low;
+#endif
+	}
+
+	//
+	// AVX2 needs the OS to preserve the upper halves of the YMM
+	// registers as well as the CPU supporting the instructions.
+	//
+	StringScan::Level DetectSupportedLevel()
+	{
+		int info[4];
+		CPUID(info, 0);
+		int maxleaf = info[0];
+
+		CPUID(info, 1);
+		if(!(info[3] & (1 << 26)))
+			return StringScan::LevelScalar;
+
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+		if(maxleaf < 7 || !osxsave || !avx || (ReadXCR0() & 0x6) != 0x6)
+			return StringScan::LevelSSE2;
+
+		CPUID(info, 7);
+		if(!(info[1] & (1 << 5)))
+			return StringScan::LevelSSE2;
+
+		return StringScan::LevelAVX2;
+	}
+
+	StringScan::Level GetSupportedLevel()
+	{
+		static const StringScan::Level supported = DetectSupportedLevel();
+		return supported;
+	}
+
+	StringScan::Level GetConfiguredLevel()
+	{
+		StringScan::Level level = GetSupportedLevel();
+
+		const char* setting = getenv("EPOCH_STRING_SIMD");
+		if(!setting)
+			return level;
+
+		if(strcmp(setting, "scalar") == 0)
+			return StringScan::LevelScalar;
+		else if(strcmp(setting, "sse2") == 0)
+			return std::min(level, StringScan::LevelSSE2);
+
+		return level;
+	}
+
+
+	std::atomic<const Kernels*> ActiveKernels(nullptr);
+
+	const Kernels& GetKernels()
+	{
+		const Kernels* kernels = ActiveKernels.load(std::memory_order_relaxed);
+		if(!kernels)
+		{
+			kernels = &LevelKernels[GetConfiguredLevel()];
+			ActiveKernels.store(kernels, std::memory_order_relaxed);
+		}
+
+		return *kernels;
+	}
+
+}
+
+
+
+size_t StringScan::FindChar(const char* s, size_t length, char c, size_t start)
+{
+	if(start >= length)
+		return NotFound;
+
+	return GetKernels().FindChar(s, length, c, start);
+}
+
+//
+// An empty needle is found wherever the search starts, as long as
+// that is within the string (or at its very end).
+//
+size_t StringScan::Find(const char* s, size_t length, const char* needle, size_t needlelength, size_t start)
+{
+	if(start > length || needlelength > length - start)
+		return NotFound;
+
+	if(needlelength == 0)
+		return start;
+
+	if(needlelength == 1)
+		return GetKernels().FindChar(s, length, needle[0], start);
+
+	return GetKernels().Find(s, length, needle, needlelength, start);
+}
+
+size_t StringScan::FindAnyOf(const char* s, size_t length, const char* set, size_t setlength, size_t start)
+{
+	if(start >= length || setlength == 0)
+		return NotFound;
+
+	if(setlength == 1)
+		return GetKernels().FindChar(s, length, set[0], start);
+
+	return GetKernels().FindAnyOf(s, length, set, setlength, start);
+}
+
+//
+// Position of the first character at or after start that belongs
+// to none of the given classes.
+//
+size_t StringScan::SkipClass(const char* s, size_t length, unsigned classes, size_t start)
+{
+	if(start >= length)
+		return NotFound;
+
+	return GetKernels().SkipClass(s, length, classes, start);
+}
+
+
+StringScan::Level StringScan::GetLevel()
+{
+	return static_cast<Level>(&GetKernels() - LevelKernels);
+}
+
+//
+// Switch kernels, for comparing them against each other; asking for
+// more than the machine supports gets the best it does support.
+//
+StringScan::Level StringScan::SetLevel(Level level)
+{
+	level = std::min(level, GetSupportedLevel());
+	ActiveKernels.store(&LevelKernels[level], std::memory_order_relaxed);
+	return level;
+}
+
@@ -0,0 +1,46 @@
+#pragma once
+
+
+//
+// Searching and scanning kernels for string contents
+//
+// Each operation comes in a scalar form and in SSE2 and AVX2 forms
+// that look at 16 or 32 characters per step. The widest set the CPU
+// (and OS) supports is picked the first time any of them is used;
+// EPOCH_STRING_SIMD=scalar|sse2|avx2 caps the choice, which is handy
+// for comparing them or ruling them out when chasing a bug.
+//
+// Lengths are always given explicitly and nothing is read past them,
+// so the kernels work on any character range and never touch memory
+// beyond the end of a block.
+//
+// Positions returned are absolute offsets into the range, or NotFound.
+//
+namespace StringScan
+{
+	const size_t NotFound = ~size_t(0);
+
+	enum CharClass
+	{
+		ClassWhitespace = 1,
+		ClassDigit = 2,
+		ClassAlpha = 4,
+		ClassUnderscore = 8
+	};
+
+	enum Level
+	{
+		LevelScalar,
+		LevelSSE2,
+		LevelAVX2
+	};
+
+	size_t FindChar(const char* s, size_t length, char c, size_t start);
+	size_t Find(const char* s, size_t length, const char* needle, size_t needlelength, size_t start);
+	size_t FindAnyOf(const char* s, size_t length, const char* set, size_t setlength, size_t start);
+	size_t SkipClass(const char* s, size_t length, unsigned classes, size_t start);
+
+	Level GetLevel();
+	Level SetLevel(Level level);
+}
+
@@ -1,5 +1,7 @@
 // dllmain.cpp : Defines the entry point for the DLL application.
 #include "stdafx.h"
+#include "GC.h"
+#include "Output.h"
 
 BOOL APIENTRY DllMain( HMODULE hModule,
                        DWORD  ul_reason_for_call,
@@ -8,10 +10,17 @@ BOOL APIENTRY DllMain( HMODULE hModule,
 {
 	switch (ul_reason_for_call)
 	{
-	case DLL_PROCESS_ATTACH:
-	case DLL_THREAD_ATTACH:
 	case DLL_THREAD_DETACH:
+		GC::DetachThread();
+		break;
+
 	case DLL_PROCESS_DETACH:
+		Output::Shutdown();
+		GC::Shutdown();
+		break;
+
+	case DLL_PROCESS_ATTACH:
+	case DLL_THREAD_ATTACH:
 		break;
 	}
 	return TRUE;
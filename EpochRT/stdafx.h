@@ -5,17 +5,22 @@
 
 #pragma once
 
+#ifdef _WIN32
 #include "targetver.h"
 
 #define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
 // Windows Header Files:
 #include <windows.h>
+#endif
 
 
 #include <string>
 #include <vector>
+#include <unordered_set>
 #include <sstream>
 
 #include <algorithm>
 
+#include <cassert>
+
 #include <iostream>
\ No newline at end of file